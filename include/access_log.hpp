@@ -0,0 +1,56 @@
+#pragma once
+#include "access_log_format.hpp"
+#include "config.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace minihttpd {
+
+// Binary access log. Request threads only copy a 256-byte record into a
+// buffer; a background thread appends the buffer to access_log_file about
+// once a second or whenever 64 KiB have piled up. Records beyond a 4 MiB
+// backlog are dropped (and counted) rather than stalling requests.
+class AccessLog {
+public:
+  static AccessLog& instance();
+
+  // (Re)opens the file, e.g. after rotation on SIGHUP; "" disables the log.
+  void configure(const ServerConfig& cfg);
+
+  // Appends r with the strings filled in, if sampling or the slow threshold
+  // (measured first byte -> flushed) select it.
+  void record(AccessRecord r, std::string_view method, std::string_view peer, std::string_view target);
+
+  // Writes out what is buffered and stops the flusher.
+  void shutdown();
+
+private:
+  AccessLog() = default;
+  bool should_log(uint64_t total_ns, uint8_t& flags);
+  void run();
+  void write_out(std::unique_lock<std::mutex>& lk);
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint32_t> sample_every_{1};
+  std::atomic<uint64_t> slow_ns_{0};
+  std::atomic<uint64_t> counter_{0};
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::string pending_;
+  uint64_t dropped_ = 0;
+  bool stop_ = false;
+  std::thread flusher_;
+
+  std::mutex io_mu_;  // guards fd_ and path_ while writing or reopening
+  int fd_ = -1;
+  std::string path_;
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+
+namespace minihttpd {
+
+// On-disk access log: AccessLogHeader, then fixed-size AccessRecords in host
+// byte order. Every process that opens the file appends a fresh header (the
+// monotonic clock differs across reboots), so readers must accept one at any
+// record boundary; the magic can never be the start of a record because no
+// accept_ns is that large. Shared with tools/accesslog_dump.cpp, so this
+// header has no other dependencies.
+
+inline constexpr char kAccessLogMagic[8] = {'M', 'H', 'A', 'C', 'L', 'O', 'G', '1'};
+
+struct AccessLogHeader {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+  // CLOCK_MONOTONIC and CLOCK_REALTIME read together when the file was
+  // started, for turning record timestamps into wall time.
+  uint64_t mono_base_ns;
+  uint64_t wall_base_ns;
+  uint8_t pad[32];
+};
+static_assert(sizeof(AccessLogHeader) == 64);
+
+enum AccessFlags : uint8_t {
+  kAccessTls = 1 << 0,
+  kAccessKeepAlive = 1 << 1,
+  kAccessSlow = 1 << 2,  // logged because of access_log_slow_ms, not sampling
+};
+
+// Timestamps are CLOCK_MONOTONIC nanoseconds; 0 means the phase was never
+// reached (e.g. a body the handler rejected without reading).
+struct AccessRecord {
+  uint64_t accept_ns;
+  uint64_t first_byte_ns;
+  uint64_t headers_ns;
+  uint64_t body_done_ns;
+  uint64_t flushed_ns;
+
+  uint64_t bytes_in;   // request line, headers and body consumed
+  uint64_t bytes_out;  // everything written for the response
+  uint64_t conn_id;
+
+  uint16_t status;
+  uint16_t seq;  // request number on the connection, from 1
+  uint8_t flags;
+  uint8_t reserved[3];
+
+  // NUL-padded, truncated to fit.
+  char method[8];
+  char peer[48];
+  char target[128];
+};
+static_assert(sizeof(AccessRecord) == 256);
+
+}
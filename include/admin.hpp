@@ -0,0 +1,14 @@
+#pragma once
+
+namespace minihttpd {
+
+class Router;
+
+inline constexpr const char* kAdminPrefix = "/_admin";
+
+// Server introspection, served only on listeners with "admin": true:
+//   GET /_admin/memory   memory accounting breakdown (JSON)
+// Anything else under /_admin is 404 there. Kept out of register_routes().
+void register_admin_routes(Router& r);
+
+}
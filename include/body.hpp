@@ -0,0 +1,48 @@
+#pragma once
+#include "connection.hpp"
+
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace minihttpd {
+
+// Streams a Content-Length delimited request body: first the bytes that were
+// read together with the header, then straight from the socket. Bytes past
+// the body (a pipelined request) are kept aside for the next request.
+// With expect_continue, "100 Continue" is sent on the first socket read, so a
+// handler that rejects the request without reading never solicits the body.
+class BodyReader {
+public:
+  BodyReader(Connection& conn, uint64_t content_length, std::string already, bool expect_continue = false);
+
+  // >0 bytes read, 0 at end of body, -1 on socket error or timeout.
+  ssize_t read(void* dst, size_t len);
+
+  bool discard(size_t chunk_size);
+
+  uint64_t content_length() const { return content_length_; }
+  uint64_t remaining() const { return remaining_; }
+  bool done() const { return remaining_ == 0; }
+
+  // mono_ns() when the last body byte was consumed; 0 while not done and
+  // for empty bodies.
+  uint64_t done_ns() const { return done_ns_; }
+
+  // The client is still waiting for "100 Continue" and has sent no body yet.
+  bool awaiting_continue() const { return continue_pending_; }
+
+  std::string take_leftover() { return std::move(leftover_); }
+
+private:
+  Connection& conn_;
+  uint64_t content_length_;
+  uint64_t remaining_;
+  std::string prefix_;
+  size_t prefix_pos_ = 0;
+  std::string leftover_;
+  bool continue_pending_ = false;
+  uint64_t done_ns_ = 0;
+};
+
+}
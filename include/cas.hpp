@@ -0,0 +1,40 @@
+#pragma once
+#include "config.hpp"
+
+#include <filesystem>
+#include <string>
+
+namespace minihttpd {
+
+// Content-addressed store under <root_dir>/.cas: each distinct body is kept
+// once as .cas/<2 hex>/<sha-256 hex>, and user-visible names are hard links
+// to it. The inode link count is the reference count, so identical uploads
+// share one copy on disk and in the page cache.
+inline constexpr const char* kCasDir = ".cas";
+
+bool cas_enabled(const ServerConfig& cfg);
+
+// True for URL paths inside the store itself, which are never served.
+bool is_reserved_path(const std::string& url_path);
+
+std::filesystem::path cas_blob_path(const ServerConfig& cfg, const std::string& sha_hex);
+
+// Where an upload is written before its hash is known.
+std::filesystem::path cas_temp_path(const ServerConfig& cfg);
+
+// "sha-256" Digest value (base64) -> lower-case hex; empty if malformed.
+std::string sha256_b64_to_hex(const std::string& b64);
+
+// Moves a fully written temp file into the store, or drops it when the blob
+// already exists, then points final_path at the blob.
+bool cas_commit(const ServerConfig& cfg, const std::filesystem::path& temp, const std::string& sha_hex,
+                const std::filesystem::path& final_path, bool& deduplicated, std::string& err);
+
+// Points final_path at an existing blob; false when it is not stored yet.
+bool cas_link_existing(const ServerConfig& cfg, const std::string& sha_hex,
+                       const std::filesystem::path& final_path, std::string& err);
+
+// Removes a name and frees its blob once no other name refers to it.
+bool cas_remove(const ServerConfig& cfg, const std::filesystem::path& final_path, bool& freed, std::string& err);
+
+}
@@ -1,20 +1,82 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <cstdint>
 
 namespace minihttpd {
 
+struct ListenerConfig {
+  enum class Kind { TCP, UNIX };
+  Kind kind = Kind::TCP;
+
+  std::string address = "127.0.0.1";
+  uint16_t port = 8080;
+  bool ipv6_only = false;
+
+  std::string path;
+
+  uint32_t backlog = 511;
+
+  bool tcp_nodelay = true;
+  uint32_t tcp_defer_accept_sec = 0;
+  uint32_t tcp_fastopen_qlen = 0;
+  uint32_t rcvbuf = 0;
+  uint32_t sndbuf = 0;
+
+  bool tls = false;
+  // Serves /_admin; everywhere else those paths are ordinary files.
+  bool admin = false;
+};
+
+struct UpstreamConfig {
+  std::string host;
+  uint16_t port = 0;
+
+  std::string path;
+};
+
+struct ProxyRouteConfig {
+  std::string prefix;
+  std::vector<UpstreamConfig> upstreams;
+  bool strip_prefix = false;
+
+  uint32_t pool_size = 16;
+  uint32_t connect_timeout_ms = 1000;
+  uint32_t timeout_sec = 30;
+
+  uint32_t health_check_interval_ms = 0;
+  std::string health_check_path;
+};
+
 struct ServerConfig {
   std::string server_ip = "127.0.0.1";
   uint16_t port = 8080;
 
   uint32_t max_clients = 128;
 
+  // Ceiling for accounted buffers and caches (0 = account only); see
+  // memory_budget.hpp.
+  uint64_t memory_budget_bytes = 0;
+
+  std::vector<ListenerConfig> listeners;
+
+  std::string tls_cert_file;
+  std::string tls_key_file;
+  bool tls_session_tickets = true;
+  uint32_t tls_session_cache_size = 20480;
+  bool tls_ktls = true;
+
   std::string root_dir = "./www";
 
   std::string log_file = "./server.log";
   std::string log_level = "INFO"; 
 
+  // Binary per-request log ("" = off). Every Nth request is kept (0 = none)
+  // plus every request slower than access_log_slow_ms (0 = no threshold).
+  std::string access_log_file;
+  uint32_t access_log_sample_every = 1;
+  uint32_t access_log_slow_ms = 0;
+
   bool keep_alive = true;
   uint32_t keep_alive_timeout_sec = 10;
   uint32_t keep_alive_max_requests = 100;
@@ -22,6 +84,20 @@ struct ServerConfig {
   uint32_t read_header_max_bytes = 32768; 
   uint32_t recv_chunk_size = 65536;       
 
+  uint32_t drain_timeout_sec = 30;
+
+  uint64_t upload_max_part_bytes = 4ull << 30;
+  uint64_t upload_max_total_bytes = 16ull << 30;
+
+  bool upload_digest_sha256 = false;
+
+  std::string storage_mode = "plain";
+
+  uint32_t upload_max_sessions = 256;
+  uint32_t upload_session_ttl_sec = 86400;
+
+  std::vector<ProxyRouteConfig> proxy_routes;
+
 };
 
 ServerConfig load_config_json(const std::string& path);
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+namespace minihttpd {
+
+// An accepted client socket. The fd is non-blocking; reads and writes wait
+// at most timeout_sec for the peer. Owns and closes the fd. After
+// start_tls() the same calls go through OpenSSL, or straight to the socket
+// once OpenSSL has handed the record layer to the kernel (kTLS).
+class Connection {
+public:
+  Connection(int fd, std::string peer);
+  ~Connection();
+
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  int fd() const { return fd_; }
+  const std::string& peer() const { return peer_; }
+
+  // Server handshake, bounded by the current timeout.
+  bool start_tls(SSL_CTX* ctx, std::string& err);
+  bool is_tls() const { return ssl_ != nullptr; }
+  SSL* ssl() const { return ssl_; }
+  bool ktls_send() const { return ktls_send_; }
+  bool ktls_recv() const { return ktls_recv_; }
+
+  void set_timeout_sec(uint32_t sec);
+  int timeout_ms() const { return timeout_ms_; }
+
+  // 1 = readable, 0 = timed out, -1 = error.
+  int wait_readable(int timeout_ms);
+
+  ssize_t recv_some(void* buf, size_t len);
+  bool send_all(const void* data, size_t len);
+  bool send_string(const std::string& s);
+  bool send_file(int file_fd, uint64_t offset, uint64_t len);
+
+  // For the access log: bytes fully written so far, and the status of the
+  // last response head sent (0 if none since reset_status()).
+  uint64_t bytes_sent() const { return bytes_sent_; }
+  int status() const { return status_; }
+  void note_status(int status) { status_ = status; }
+  void reset_status() { status_ = 0; }
+
+  // Set per request; send_response() then keeps Content-Length but leaves
+  // out the body, so no handler has to special-case HEAD for its replies.
+  void set_head_request(bool head) { head_request_ = head; }
+  bool head_request() const { return head_request_; }
+
+private:
+  // Waits for what SSL_get_error asked for; false on timeout or a hard error.
+  bool wait_tls(int ssl_error);
+
+  int fd_;
+  std::string peer_;
+  int timeout_ms_ = 10000;
+
+  SSL* ssl_ = nullptr;
+  bool ktls_send_ = false;
+  bool ktls_recv_ = false;
+
+  uint64_t bytes_sent_ = 0;
+  int status_ = 0;
+  bool head_request_ = false;
+};
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+namespace minihttpd {
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it.
+class Crc32c {
+public:
+  void update(const void* data, size_t len);
+  uint32_t value() const { return ~state_; }
+
+  static bool hardware_accelerated();
+
+private:
+  uint32_t state_ = 0xFFFFFFFFu;
+};
+
+// SHA-256 through OpenSSL's EVP interface, which picks the SHA-NI / AVX2
+// code paths the CPU supports.
+class Sha256 {
+public:
+  Sha256();
+  ~Sha256();
+
+  Sha256(const Sha256&) = delete;
+  Sha256& operator=(const Sha256&) = delete;
+
+  void update(const void* data, size_t len);
+  std::array<uint8_t, 32> finish();
+
+private:
+  EVP_MD_CTX* ctx_;
+};
+
+std::string base64_encode(const void* data, size_t len);
+bool base64_decode(const std::string& in, std::string& out);
+std::string hex_encode(const void* data, size_t len);
+
+// RFC 3230 instance digests ("crc32c=<b64>, sha-256=<b64>"); the crc32c value
+// is the big-endian checksum, base64 encoded.
+struct DigestValues {
+  std::string crc32c;
+  std::string sha256;
+};
+
+DigestValues parse_digest_header(const std::string& v);
+std::string format_digest_header(const DigestValues& d);
+bool want_digest_has(const std::string& want_digest, const std::string& alg);
+
+std::string crc32c_b64(uint32_t crc);
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "handler.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace minihttpd {
+
+// GET/HEAD on a directory: a paginated listing streamed as a chunked JSON or
+// HTML body. Names are served in byte order from a cached snapshot built
+// with getdents64(2), keyed by inode and dropped when the directory's
+// mtime/ctime change; ?order=disk streams getdents64 directly instead.
+//
+// Query: after=<name> | cursor=<token>, limit=N, stat=1 (size and mtime),
+// format=json|html (default from Accept).
+void handle_dir_listing(RequestContext& ctx, int dir_fd, const std::string& url_path, const std::string& query);
+
+// Evicts least recently used snapshots until `want` bytes are out of the
+// cache; a MemShrinker. Listings still streaming keep theirs alive.
+uint64_t dirlist_cache_trim(uint64_t want);
+
+}
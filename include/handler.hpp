@@ -0,0 +1,24 @@
+#pragma once
+#include "body.hpp"
+#include "config.hpp"
+#include "connection.hpp"
+#include "http.hpp"
+
+namespace minihttpd {
+
+struct RequestContext {
+  Connection& conn;
+  const ServerConfig& cfg;
+  const HttpRequest& req;
+  BodyReader& body;
+  bool keep_alive;
+
+  // Set by a handler whose response cannot be followed by another request,
+  // e.g. a relayed body delimited by connection close.
+  bool force_close = false;
+
+  // The connection can only be reused once the whole body has been read.
+  bool reply_keep_alive() const { return keep_alive && body.done(); }
+};
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "listener.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+namespace minihttpd {
+
+// Environment variable carrying the inherited end of the handoff socket when
+// a new binary is started by a running server (binary upgrade).
+inline constexpr const char* kHandoffEnv = "MINIHTTPD_HANDOFF_FD";
+
+// Old process: forks and execs argv with a socketpair end in kHandoffEnv.
+pid_t spawn_upgrade(const std::vector<std::string>& argv, int& parent_sock, std::string& err);
+
+// Old process: passes every listening fd (SCM_RIGHTS) together with its name.
+bool send_listeners(int sock, const std::vector<Listener>& listeners, std::string& err);
+
+// Old process: waits for the new process to report that it is accepting.
+bool wait_upgrade_ready(int sock, int timeout_ms, std::string& err);
+
+// New process: receives (name, fd) pairs. The fds arrive close-on-exec.
+bool receive_listeners(int sock, std::vector<std::pair<std::string, int>>& out, std::string& err);
+
+// New process: tells the old process it can stop accepting and drain.
+bool notify_upgrade_ready(int sock);
+
+}
@@ -10,11 +10,26 @@ struct HttpRequest {
   std::string target;
   std::string version;
 
+  // Last value per lower-cased name; `head` keeps the lines as received,
+  // repeated fields and order included, for relaying.
   std::unordered_map<std::string, std::string> headers;
+  std::string head;
 
   uint64_t content_length = 0;
 };
 
+struct HttpResponse {
+  std::string version;
+  int status = 0;
+  std::string reason;
+
+  std::unordered_map<std::string, std::string> headers;
+
+  bool has_content_length = false;
+  uint64_t content_length = 0;
+  bool chunked = false;
+};
+
 struct HttpResponseHead {
   int status = 200;
   std::string reason = "OK";
@@ -25,11 +40,47 @@ std::string http_date_now();
 std::string status_reason(int status);
 std::string content_type_for_path(const std::string& path);
 
+// On failure status is the reply to send: 400, or 501 for a request body
+// framed with Transfer-Encoding, which is not supported. Transfer-Encoding
+// together with Content-Length is always 400 (RFC 9112 6.3), so the two can
+// never be read differently here and by a proxied upstream.
 bool parse_http_request_headers(
   const std::string& header_blob,
   HttpRequest& out,
+  std::string& err,
+  int& status);
+
+bool parse_http_response_headers(
+  const std::string& header_blob,
+  HttpResponse& out,
   std::string& err);
 
 std::string build_response_head(const HttpResponseHead& head);
 
+// Finds the end of a chunked message body without decoding it, so it can be
+// relayed byte for byte.
+class ChunkedScanner {
+public:
+  // Consumes bytes up to and including the end of the message. With
+  // payload set, the chunk data (without framing) is appended to it.
+  size_t feed(const char* data, size_t len, std::string* payload = nullptr);
+
+  bool done() const { return state_ == State::DONE; }
+  bool bad() const { return bad_; }
+
+private:
+  enum class State { SIZE, EXT, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER_START, TRAILER_LINE, FINAL_LF, DONE };
+
+  State state_ = State::SIZE;
+  uint64_t size_ = 0;
+  bool saw_digit_ = false;
+  bool bad_ = false;
+};
+
+// Splits a request target into its decoded path and raw query string.
+void split_target(const std::string& target, std::string& path, std::string& query);
+
+// Looks up a decoded key=value pair in a raw query string.
+bool query_param(const std::string& query, const std::string& key, std::string& out);
+
 } 
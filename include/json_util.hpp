@@ -0,0 +1,14 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <string>
+
+namespace minihttpd {
+
+// Serializes a reply. Names from URLs, multipart headers and directories
+// need not be UTF-8; invalid bytes become U+FFFD instead of throwing.
+inline std::string dump_json(const nlohmann::json& j) {
+  return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+}
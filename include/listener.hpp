@@ -0,0 +1,28 @@
+#pragma once
+#include "config.hpp"
+
+#include <string>
+
+namespace minihttpd {
+
+struct Listener {
+  ListenerConfig cfg;
+  std::string name;
+  int fd = -1;
+};
+
+std::string listener_name(const ListenerConfig& lc);
+
+// Creates, configures, binds and listens a non-blocking, close-on-exec socket.
+bool open_listener(const ListenerConfig& lc, Listener& out, std::string& err);
+// Takes over a listening socket inherited from a previous process; re-applies
+// the backlog so a reload can change it.
+bool adopt_listener(const ListenerConfig& lc, int fd, Listener& out, std::string& err);
+
+void close_listener(Listener& l);
+
+// accept4(SOCK_NONBLOCK | SOCK_CLOEXEC). Returns -1 with errno set when
+// nothing is pending (EAGAIN) or on error.
+int accept_connection(const Listener& l, std::string& peer);
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "config.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace minihttpd {
+
+enum class MemCategory : uint8_t {
+  Connections,    // header buffers, receive chunks, pipelined bytes, TLS records
+  RequestBodies,  // upload / PUT / discard buffers, hashing
+  Responses,      // file buffers for userspace TLS
+  Proxy,          // relay buffers
+  DirListings,    // directory snapshots, cached or being streamed
+  Count,
+};
+
+// Accounting against memory_budget_bytes (0 = count only, never refuse).
+// Anything allocated on behalf of a request is reserved before it is
+// allocated (mem_reserve / MemCharge::try_resize, a CAS on the total), so
+// concurrent requests cannot jointly overshoot. Above 90% of the budget
+// caches are shrunk and stop growing; connections that cannot reserve their
+// receive buffers get 503 at accept or wait before reading the next request.
+void configure_memory_budget(const ServerConfig& cfg);
+
+// Frees cached memory; returns the bytes released. Shrinkers take their own
+// locks, so they are only run by callers that hold none.
+using MemShrinker = uint64_t (*)(uint64_t want);
+void add_memory_shrinker(MemShrinker fn);
+
+// Unconditional; for memory that already exists (e.g. resizing down).
+void mem_charge(MemCategory c, uint64_t bytes);
+// Charges only if the total stays within the budget. Plain atomics, so
+// both are safe to call under any lock.
+bool mem_try_charge(MemCategory c, uint64_t bytes);
+void mem_release(MemCategory c, uint64_t bytes);
+
+// Above the high watermark: do not grow caches.
+bool mem_pressure();
+// At or over the budget.
+bool mem_exhausted();
+
+// Runs the shrinkers if above the high watermark.
+void mem_relieve();
+
+// For accept-time 503s, counted in the stats.
+void mem_note_rejected();
+
+// Live breakdown for /_admin/memory.
+std::string mem_stats_json();
+
+// Holds a charge until destroyed. resize() tracks memory that exists
+// already; try_resize() reserves growth within the budget.
+class MemCharge {
+public:
+  explicit MemCharge(MemCategory c, uint64_t bytes = 0) : cat_(c) { resize(bytes); }
+  ~MemCharge() { resize(0); }
+
+  MemCharge(MemCharge&& o) noexcept : cat_(o.cat_), bytes_(o.bytes_) { o.bytes_ = 0; }
+  MemCharge(const MemCharge&) = delete;
+  MemCharge& operator=(const MemCharge&) = delete;
+
+  void resize(uint64_t bytes) {
+    if (bytes > bytes_) mem_charge(cat_, bytes - bytes_);
+    else if (bytes < bytes_) mem_release(cat_, bytes_ - bytes);
+    bytes_ = bytes;
+  }
+
+  bool try_resize(uint64_t bytes) {
+    if (bytes > bytes_ && !mem_try_charge(cat_, bytes - bytes_)) return false;
+    if (bytes < bytes_) mem_release(cat_, bytes_ - bytes);
+    bytes_ = bytes;
+    return true;
+  }
+
+  uint64_t bytes() const { return bytes_; }
+
+private:
+  MemCategory cat_;
+  uint64_t bytes_ = 0;
+};
+
+// try_resize, retried once after shrinking caches. Call without locks held.
+bool mem_reserve(MemCharge& c, uint64_t bytes);
+
+// mem_reserve, waiting up to timeout_ms for other requests to release
+// memory; false (counted as refused) if it never fits.
+bool mem_wait_for_room(MemCharge& c, uint64_t bytes, int timeout_ms);
+
+}
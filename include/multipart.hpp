@@ -0,0 +1,59 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace minihttpd {
+
+struct MultipartPart {
+  std::unordered_map<std::string, std::string> headers;  // lower-case names
+  std::string name;
+  std::string filename;
+  bool has_filename = false;
+};
+
+// Extracts the boundary parameter of a multipart/form-data Content-Type.
+bool multipart_boundary(const std::string& content_type, std::string& out);
+
+// Incremental multipart/form-data parser. Input is pushed in arbitrary chunks;
+// part bodies are handed out as they are found, so memory use is bounded by
+// one input chunk plus the delimiter length regardless of part size. The
+// delimiter is located with Boyer-Moore-Horspool.
+class MultipartParser {
+public:
+  struct Callbacks {
+    std::function<bool(const MultipartPart&)> on_part_begin;
+    std::function<bool(const char*, size_t)> on_part_data;
+    std::function<bool()> on_part_end;
+  };
+
+  MultipartParser(const std::string& boundary, Callbacks cb, size_t max_part_header_bytes = 8192);
+
+  // Returns false on malformed input or when a callback rejects; see error().
+  bool feed(const char* data, size_t len);
+
+  bool finished() const { return state_ == State::DONE; }
+  const std::string& error() const { return err_; }
+
+private:
+  enum class State { PREAMBLE, AFTER_DELIM, HEADERS, BODY, DONE, FAILED };
+
+  size_t find_delim(size_t from) const;
+  bool fail(const std::string& e);
+  bool parse_part_headers(const std::string& blob, MultipartPart& part);
+
+  std::string delim_;               // "\r\n--" + boundary
+  size_t skip_[256];
+  Callbacks cb_;
+  size_t max_header_bytes_;
+
+  State state_ = State::PREAMBLE;
+  std::string buf_;
+  size_t pos_ = 0;
+  std::string err_;
+};
+
+}
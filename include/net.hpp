@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace minihttpd {
+
+void close_quiet(int fd);
+bool set_nonblocking(int fd);
+
+// poll() on a single fd: 1 = ready, 0 = timed out, -1 = error.
+int wait_fd(int fd, short events, int timeout_ms);
+
+// Non-blocking fd helpers that wait up to timeout_ms whenever the socket
+// would block. A timeout is reported as -1 / false with errno = ETIMEDOUT.
+ssize_t recv_some(int fd, void* buf, size_t len, int timeout_ms);
+bool send_all(int fd, const void* data, size_t len, int timeout_ms);
+
+// sendfile(2) of [offset, offset + len) from a regular file to a socket.
+bool send_file_all(int sock_fd, int file_fd, uint64_t offset, uint64_t len, int timeout_ms);
+
+// Blocking write() loop for regular files.
+bool write_all(int fd, const void* data, size_t len);
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "handler.hpp"
+
+#include <string>
+
+namespace minihttpd {
+
+// Publishes the upstream pools of a (re)loaded config and starts health
+// checks; pools of dropped routes or upstreams are retired. Call it before
+// publishing the config itself.
+void configure_proxy(const ServerConfig& cfg);
+
+// Longest proxy_routes prefix matching path, or nullptr.
+const ProxyRouteConfig* find_proxy_route(const ServerConfig& cfg, const std::string& path);
+
+// Relays the request to the least-loaded healthy upstream of the route over a
+// pooled keep-alive connection. Bodies are streamed in both directions.
+void handle_proxy(RequestContext& ctx, const ProxyRouteConfig& route);
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace minihttpd {
+
+// Set of disjoint half-open byte ranges [begin, end); adjacent and
+// overlapping inserts are merged, so a file filled in order stays one entry.
+class RangeSet {
+public:
+  void add(uint64_t begin, uint64_t end);
+
+  uint64_t covered() const { return covered_; }
+  bool covers(uint64_t begin, uint64_t end) const;
+  // True if adding [begin, end) would merge into an existing range instead
+  // of creating a new one.
+  bool touches(uint64_t begin, uint64_t end) const;
+  size_t size() const { return ranges_.size(); }
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges() const;
+
+private:
+  std::map<uint64_t, uint64_t> ranges_;
+  uint64_t covered_ = 0;
+};
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "connection.hpp"
+#include "http.hpp"
+#include "memory_budget.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace minihttpd {
+
+// Date, Server and Connection; the status reason is derived from the code.
+void set_common_headers(HttpResponseHead& head, bool keep_alive);
+
+bool send_head(Connection& conn, HttpResponseHead head, bool keep_alive);
+
+// Sends head and body in a single write; Content-Length is filled in. The
+// body is left out when the request is HEAD.
+bool send_response(Connection& conn, HttpResponseHead head, const std::string& body, bool keep_alive);
+
+// Head of a body of unknown length: chunked when the client speaks HTTP/1.1,
+// otherwise delimited by closing the connection.
+bool send_stream_head(Connection& conn, HttpResponseHead head, bool chunked, bool keep_alive);
+
+// Batches small writes into chunks of about flush_bytes.
+class ChunkedWriter {
+public:
+  ChunkedWriter(Connection& conn, bool chunked, size_t flush_bytes = 16384);
+
+  bool write(std::string_view s);
+  bool finish();
+
+private:
+  bool flush();
+
+  Connection& conn_;
+  bool chunked_;
+  size_t flush_bytes_;
+  std::string buf_;
+  MemCharge mem_{MemCategory::Responses};
+};
+
+bool send_json(Connection& conn, int status, const std::string& json, bool keep_alive);
+
+struct RequestContext;
+
+// Reserves a per-request buffer against the memory budget, or replies 503
+// and returns false.
+bool reserve_or_503(RequestContext& ctx, MemCharge& mem, uint64_t bytes);
+
+void send_error(Connection& conn, int status, bool keep_alive,
+                const std::string& detail = "minihttpd could not process your request.");
+
+}
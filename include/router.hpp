@@ -0,0 +1,86 @@
+#pragma once
+#include "handler.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace minihttpd {
+
+enum MethodBit : uint16_t {
+  kMethodGet = 1 << 0,
+  kMethodHead = 1 << 1,
+  kMethodPost = 1 << 2,
+  kMethodPut = 1 << 3,
+  kMethodDelete = 1 << 4,
+  kMethodOptions = 1 << 5,
+  kMethodPatch = 1 << 6,
+  kMethodAny = (1 << 7) - 1,
+};
+
+// 0 for methods the server does not implement at all (-> 501).
+uint16_t method_bit(std::string_view method);
+
+inline constexpr size_t kMaxRouteParams = 8;
+
+// Captures of one match, as views into the request path.
+struct RouteParams {
+  std::array<std::pair<std::string_view, std::string_view>, kMaxRouteParams> items{};
+  size_t count = 0;
+
+  // Empty when the route has no such capture.
+  std::string_view get(std::string_view name) const;
+};
+
+using RouteHandler = void (*)(RequestContext& ctx, const RouteParams& params);
+
+struct RouteMatch {
+  enum class Result { Found, NotFound, MethodNotAllowed, NotImplemented };
+
+  Result result = Result::NotFound;
+  RouteHandler handler = nullptr;
+  bool reads_body = true;
+  uint16_t allowed = 0;
+  RouteParams params;
+};
+
+// Routes compiled into a trie over path segments. A pattern segment is
+// literal, ":name" (one segment) or "*name" (the rest of the path, possibly
+// empty; last segment only). Literal beats ":name" beats "*name"; the most
+// specific path that matches decides between the handler, 405 (with the
+// methods it does allow) and 404. Empty and "." segments are ignored.
+//
+// Matching walks the path once, captures string_views and does not allocate.
+class Router {
+public:
+  Router();
+  ~Router();
+
+  Router(const Router&) = delete;
+  Router& operator=(const Router&) = delete;
+
+  // Throws std::logic_error on malformed patterns or duplicate registrations.
+  // Routes that do not read the body get it discarded before the handler runs.
+  void add(uint16_t methods, std::string_view pattern, RouteHandler handler, bool reads_body = true);
+
+  // Sorts literal children for binary search; call once after the last add().
+  void compile();
+
+  RouteMatch match(std::string_view method, std::string_view path) const;
+
+  // Runs the matched handler, or replies 404 / 405 + Allow / 501.
+  void dispatch(RequestContext& ctx, std::string_view path) const;
+
+  struct Node;  // defined in router.cpp
+
+private:
+  std::unique_ptr<Node> root_;
+};
+
+// The server's route table. Modules expose register_*_routes(Router&) and
+// are listed in routes.cpp; handle_client only calls dispatch().
+void register_routes(Router& r);
+
+}
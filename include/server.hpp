@@ -1,15 +1,37 @@
 #pragma once
 #include "config.hpp"
+#include "listener.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/types.h>
 
 namespace minihttpd {
 
 class HttpServer {
 public:
-  explicit HttpServer(ServerConfig cfg);
+  HttpServer(ServerConfig cfg, std::string config_path, std::vector<std::string> argv);
   int run();
 
 private:
+  bool open_listeners();
+  void reload_config();
+  void start_upgrade();
+  void finish_upgrade(bool timed_out);
+  void reap_children();
+  int drain();
+
   ServerConfig cfg_;
+  std::string config_path_;
+  std::vector<std::string> argv_;
+
+  std::vector<Listener> listeners_;
+  pid_t upgrade_pid_ = -1;
+  // Handoff socket while waiting for the new binary's ready byte; polled
+  // with the listeners so accepting goes on meanwhile.
+  int upgrade_sock_ = -1;
+  std::chrono::steady_clock::time_point upgrade_deadline_{};
 };
 
 } 
@@ -0,0 +1,62 @@
+#pragma once
+#include "digest.hpp"
+#include "handler.hpp"
+
+#include <cstdint>
+#include <memory>
+
+namespace minihttpd {
+
+class Router;
+
+// Writes a body to a file while hashing it, so integrity checks cost no
+// second pass over the data.
+class HashingFileWriter {
+public:
+  HashingFileWriter(int fd, bool sha256);
+
+  bool write(const void* data, size_t len);
+  uint64_t bytes() const { return bytes_; }
+
+  // base64 crc32c, plus sha-256 when enabled.
+  DigestValues finish();
+
+private:
+  int fd_;
+  uint64_t bytes_ = 0;
+  Crc32c crc_;
+  std::unique_ptr<Sha256> sha_;
+};
+
+// Digests are kept in the "user.minihttpd.digest" xattr together with the
+// size and mtime they were computed for; a stale entry is ignored on load.
+bool store_digest_xattr(int fd, const DigestValues& d);
+bool load_digest_xattr(int fd, DigestValues& d);
+
+// Hashes an already written file with pread(2), for bodies that did not
+// arrive in order.
+bool digest_file(int fd, bool sha256, DigestValues& d);
+
+// Compares computed digests with those a client sent; only algorithms present
+// on both sides are checked.
+bool digests_match(const DigestValues& computed, const DigestValues& expected);
+
+bool wants_sha256(const RequestContext& ctx);
+
+// GET/HEAD <path>: a regular file under root_dir, sent with sendfile(2), or
+// a directory listing.
+void handle_file_get(RequestContext& ctx);
+
+// PUT <path>: streams the body to <root_dir>/<path>, verifying any Digest
+// request header, and replies with the computed digests. In "cas" storage
+// mode a sha-256 Digest naming a stored blob links it without the body.
+void handle_file_put(RequestContext& ctx);
+
+// DELETE <path>: removes a stored file; in "cas" mode also its blob once
+// nothing else refers to it.
+void handle_file_delete(RequestContext& ctx);
+
+// GET/HEAD/PUT/DELETE on any path, and 404 for the reserved /.cas tree.
+void register_storage_routes(Router& r);
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "config.hpp"
+
+#include <memory>
+#include <string>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+namespace minihttpd {
+
+// Server-side SSL_CTX built from the tls_* settings: TLS 1.2+, ALPN
+// http/1.1, session tickets plus a server session cache for resumption, and
+// SSL_OP_ENABLE_KTLS so records move into the kernel after the handshake.
+class TlsContext {
+public:
+  // Ticket keys are carried over from previous (if any), so a reload does
+  // not invalidate the tickets clients already hold.
+  static std::shared_ptr<TlsContext> create(const ServerConfig& cfg, const TlsContext* previous, std::string& err);
+  ~TlsContext();
+
+  TlsContext(const TlsContext&) = delete;
+  TlsContext& operator=(const TlsContext&) = delete;
+
+  SSL_CTX* get() const { return ctx_; }
+
+private:
+  explicit TlsContext(SSL_CTX* ctx) : ctx_(ctx) {}
+  SSL_CTX* ctx_;
+};
+
+bool tls_enabled(const ServerConfig& cfg);
+
+// Drains the OpenSSL error queue into one line.
+std::string tls_error_string();
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "handler.hpp"
+
+namespace minihttpd {
+
+class Router;
+
+bool is_multipart_request(const HttpRequest& req);
+
+// POST <dir> with a multipart/form-data body: every part carrying a filename
+// is streamed to <root_dir>/<dir>/<filename>. Files are only renamed into
+// place once the whole body has been received; the reply is a JSON summary.
+void handle_multipart_upload(RequestContext& ctx);
+
+// POST on any path; other content types get 415.
+void register_upload_routes(Router& r);
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "handler.hpp"
+
+#include <string>
+
+namespace minihttpd {
+
+class Router;
+
+inline constexpr const char* kUploadSessionPrefix = "/_uploads";
+
+bool is_upload_session_path(const std::string& path);
+
+// Resumable uploads:
+//   POST   /_uploads?path=/dir/name&size=N   create a session (201, JSON with id)
+//   PUT    /_uploads/<id>                    write "Content-Range: bytes a-b/N"
+//   GET    /_uploads/<id>                    received ranges
+//   POST   /_uploads/<id>/finalize           rename into place once complete
+//   DELETE /_uploads/<id>                    abort
+// Ranges may be sent in any order and over several connections at once, but
+// a session tracks at most 1024 disjoint ranges; a PUT that would start one
+// more is refused with 409. Sessions live in memory only: they do not survive
+// a restart or a SIGUSR2 upgrade.
+// Anything else under /_uploads is 404.
+void register_upload_session_routes(Router& r);
+
+}
@@ -1,13 +1,20 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <filesystem>
 
 namespace minihttpd {
 
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t mono_ns();
+
 std::string trim(const std::string& s);
 std::string to_lower(const std::string& s);
 
 std::string url_decode(const std::string& s);
+// Percent-encodes everything but RFC 3986 unreserved characters and '/'.
+std::string url_encode(const std::string& s);
 
 std::string html_escape(const std::string& s);
 std::string error_page_html(int status, const std::string& title, const std::string& detail);
@@ -21,4 +28,11 @@ std::filesystem::path safe_join_under_root(
   bool& ok
 );
 
+// Hidden sibling of final_path with a process-unique suffix, for writing a
+// file in place and rename()-ing it over the final name.
+std::filesystem::path temp_path_for(const std::filesystem::path& final_path);
+
+// True for names temp_path_for() produces: ".<name>.tmp-<pid>-<n>".
+bool is_temp_name(std::string_view name);
+
 } 
@@ -3,6 +3,8 @@
 #include "server.hpp"
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 int main(int argc, char** argv) {
   const char* cfg_path = "./config.json";
@@ -17,7 +19,8 @@ int main(int argc, char** argv) {
     );
 
     LOG_INFO("Config loaded.");
-    minihttpd::HttpServer s(cfg);
+    std::vector<std::string> args(argv, argv + argc);
+    minihttpd::HttpServer s(cfg, cfg_path, std::move(args));
     return s.run();
   } catch (const std::exception& e) {
     std::cerr << "Fatal: " << e.what() << "\n";
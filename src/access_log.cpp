@@ -0,0 +1,154 @@
+#include "access_log.hpp"
+#include "logger.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+static constexpr size_t kFlushBytes = 64 * 1024;
+static constexpr size_t kMaxPendingBytes = 4u << 20;
+
+AccessLog& AccessLog::instance() {
+  static AccessLog inst;
+  return inst;
+}
+
+static int open_log(const std::string& path, std::string& err) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    err = std::strerror(errno);
+    return -1;
+  }
+
+  AccessLogHeader h{};
+  std::memcpy(h.magic, kAccessLogMagic, sizeof(h.magic));
+  h.record_size = sizeof(AccessRecord);
+  timespec wall{};
+  ::clock_gettime(CLOCK_REALTIME, &wall);
+  h.mono_base_ns = mono_ns();
+  h.wall_base_ns = (uint64_t)wall.tv_sec * 1000000000ull + (uint64_t)wall.tv_nsec;
+
+  if (!write_all(fd, &h, sizeof(h))) {
+    err = std::strerror(errno);
+    close_quiet(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void AccessLog::configure(const ServerConfig& cfg) {
+  sample_every_.store(cfg.access_log_sample_every);
+  slow_ns_.store((uint64_t)cfg.access_log_slow_ms * 1000000ull);
+
+  int fd = -1;
+  if (!cfg.access_log_file.empty()) {
+    std::string err;
+    fd = open_log(cfg.access_log_file, err);
+    if (fd < 0) LOG_ERROR("Cannot open access log " + cfg.access_log_file + ": " + err);
+  }
+
+  {
+    std::lock_guard<std::mutex> io(io_mu_);
+    close_quiet(fd_);
+    fd_ = fd;
+    path_ = cfg.access_log_file;
+  }
+  enabled_.store(fd >= 0);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  if (fd >= 0 && !stop_ && !flusher_.joinable()) {
+    flusher_ = std::thread([this] { run(); });
+  }
+}
+
+bool AccessLog::should_log(uint64_t total_ns, uint8_t& flags) {
+  uint64_t slow = slow_ns_.load(std::memory_order_relaxed);
+  if (slow > 0 && total_ns >= slow) {
+    flags |= kAccessSlow;
+    return true;
+  }
+  uint32_t every = sample_every_.load(std::memory_order_relaxed);
+  if (every == 0) return false;
+  return counter_.fetch_add(1, std::memory_order_relaxed) % every == 0;
+}
+
+static void copy_field(char* dst, size_t cap, std::string_view s) {
+  size_t n = std::min(s.size(), cap);
+  std::memcpy(dst, s.data(), n);
+}
+
+void AccessLog::record(AccessRecord r, std::string_view method, std::string_view peer, std::string_view target) {
+  if (!enabled_.load(std::memory_order_relaxed)) return;
+  if (!should_log(r.flushed_ns - r.first_byte_ns, r.flags)) return;
+
+  copy_field(r.method, sizeof(r.method), method);
+  copy_field(r.peer, sizeof(r.peer), peer);
+  copy_field(r.target, sizeof(r.target), target);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  if (pending_.size() >= kMaxPendingBytes) {
+    dropped_++;
+    return;
+  }
+  pending_.append(reinterpret_cast<const char*>(&r), sizeof(r));
+  if (pending_.size() >= kFlushBytes) cv_.notify_one();
+}
+
+void AccessLog::run() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stop_) {
+    cv_.wait_for(lk, std::chrono::seconds(1), [this] { return stop_ || pending_.size() >= kFlushBytes; });
+    write_out(lk);
+  }
+  write_out(lk);
+}
+
+// Called with lk held; drops it for the write so request threads only ever
+// wait for a buffer swap.
+void AccessLog::write_out(std::unique_lock<std::mutex>& lk) {
+  if (pending_.empty() && dropped_ == 0) return;
+
+  std::string out;
+  out.swap(pending_);
+  pending_.reserve(kFlushBytes);
+  uint64_t dropped = dropped_;
+  dropped_ = 0;
+  lk.unlock();
+
+  if (dropped > 0) {
+    LOG_WARN("Access log fell behind, dropped " + std::to_string(dropped) + " record(s)");
+  }
+  {
+    std::lock_guard<std::mutex> io(io_mu_);
+    if (fd_ >= 0 && !out.empty() && !write_all(fd_, out.data(), out.size())) {
+      LOG_ERROR("Access log write to " + path_ + " failed: " + std::strerror(errno));
+    }
+  }
+
+  lk.lock();
+}
+
+void AccessLog::shutdown() {
+  enabled_.store(false);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (flusher_.joinable()) flusher_.join();
+
+  std::lock_guard<std::mutex> io(io_mu_);
+  close_quiet(fd_);
+  fd_ = -1;
+}
+
+}
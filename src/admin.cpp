@@ -0,0 +1,21 @@
+#include "admin.hpp"
+#include "memory_budget.hpp"
+#include "response.hpp"
+#include "router.hpp"
+
+namespace minihttpd {
+
+static void handle_memory(RequestContext& ctx, const RouteParams&) {
+  send_json(ctx.conn, 200, mem_stats_json(), ctx.reply_keep_alive());
+}
+
+void register_admin_routes(Router& r) {
+  const std::string base = kAdminPrefix;
+  r.add(kMethodGet, base + "/memory", handle_memory, false);
+
+  r.add(kMethodAny, base + "/*rest", [](RequestContext& ctx, const RouteParams&) {
+    send_error(ctx.conn, 404, ctx.reply_keep_alive());
+  }, false);
+}
+
+}
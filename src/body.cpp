@@ -0,0 +1,72 @@
+#include "body.hpp"
+#include "memory_budget.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace minihttpd {
+
+BodyReader::BodyReader(Connection& conn, uint64_t content_length, std::string already, bool expect_continue)
+  : conn_(conn), content_length_(content_length), remaining_(content_length) {
+  continue_pending_ = expect_continue && content_length > 0 && already.empty();
+
+  if ((uint64_t)already.size() > content_length) {
+    leftover_ = already.substr((size_t)content_length);
+    already.resize((size_t)content_length);
+  }
+  prefix_ = std::move(already);
+}
+
+ssize_t BodyReader::read(void* dst, size_t len) {
+  if (remaining_ == 0 || len == 0) return 0;
+  if ((uint64_t)len > remaining_) len = (size_t)remaining_;
+
+  if (prefix_pos_ < prefix_.size()) {
+    size_t n = prefix_.size() - prefix_pos_;
+    if (n > len) n = len;
+    std::memcpy(dst, prefix_.data() + prefix_pos_, n);
+    prefix_pos_ += n;
+    remaining_ -= n;
+    if (remaining_ == 0) done_ns_ = mono_ns();
+    if (prefix_pos_ == prefix_.size()) {
+      prefix_.clear();
+      prefix_.shrink_to_fit();
+      prefix_pos_ = 0;
+    }
+    return (ssize_t)n;
+  }
+
+  if (continue_pending_) {
+    continue_pending_ = false;
+    if (!conn_.send_string("HTTP/1.1 100 Continue\r\n\r\n")) return -1;
+  }
+
+  ssize_t n = conn_.recv_some(dst, len);
+  if (n <= 0) return -1;
+  remaining_ -= (uint64_t)n;
+  if (remaining_ == 0) done_ns_ = mono_ns();
+  return n;
+}
+
+bool BodyReader::discard(size_t chunk_size) {
+  if (remaining_ == 0) return true;
+
+  // Draining must not fail for lack of budget; fall back to a stack buffer.
+  MemCharge mem(MemCategory::RequestBodies);
+  std::vector<char> heap;
+  char small[4096];
+  char* buf = small;
+  size_t len = sizeof(small);
+  if (chunk_size > len && mem_reserve(mem, chunk_size)) {
+    heap.resize(chunk_size);
+    buf = heap.data();
+    len = heap.size();
+  }
+  while (remaining_ > 0) {
+    if (read(buf, len) <= 0) return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,130 @@
+#include "cas.hpp"
+#include "digest.hpp"
+#include "logger.hpp"
+#include "net.hpp"
+#include "storage.hpp"
+#include "utils.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+namespace fs = std::filesystem;
+
+// Serializes "blob exists -> link" against "last name gone -> unlink blob";
+// both are a few metadata syscalls, so one lock is enough.
+static std::mutex g_cas_mu;
+
+bool cas_enabled(const ServerConfig& cfg) {
+  return cfg.storage_mode == "cas";
+}
+
+bool is_reserved_path(const std::string& url_path) {
+  fs::path p = fs::path(url_path).relative_path().lexically_normal();
+  auto it = p.begin();
+  return it != p.end() && *it == kCasDir;
+}
+
+fs::path cas_blob_path(const ServerConfig& cfg, const std::string& sha_hex) {
+  return fs::path(cfg.root_dir) / kCasDir / sha_hex.substr(0, 2) / sha_hex;
+}
+
+fs::path cas_temp_path(const ServerConfig& cfg) {
+  fs::path dir = fs::path(cfg.root_dir) / kCasDir / "tmp";
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  return temp_path_for(dir / "upload");
+}
+
+std::string sha256_b64_to_hex(const std::string& b64) {
+  std::string raw;
+  if (!base64_decode(b64, raw) || raw.size() != 32) return {};
+  return hex_encode(raw.data(), raw.size());
+}
+
+// Hash of the blob a stored name points at, from its digest xattr.
+static std::string stored_hash(const fs::path& p) {
+  int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0) return {};
+  DigestValues d;
+  bool ok = load_digest_xattr(fd, d);
+  close_quiet(fd);
+  return ok ? sha256_b64_to_hex(d.sha256) : std::string{};
+}
+
+// Drops the blob once the store's own link is the only one left.
+static bool release_blob(const ServerConfig& cfg, const std::string& sha_hex) {
+  if (sha_hex.empty()) return false;
+  fs::path blob = cas_blob_path(cfg, sha_hex);
+  struct stat st{};
+  if (::stat(blob.c_str(), &st) < 0 || st.st_nlink > 1) return false;
+  if (::unlink(blob.c_str()) < 0) return false;
+  LOG_DEBUG("CAS freed blob " + sha_hex);
+  return true;
+}
+
+// Atomically points final_path at blob; caller holds g_cas_mu.
+static bool link_name(const ServerConfig& cfg, const fs::path& blob, const std::string& sha_hex,
+                      const fs::path& final_path, std::string& err) {
+  fs::path tmp = temp_path_for(final_path);
+  if (::link(blob.c_str(), tmp.c_str()) < 0) {
+    err = std::string("link: ") + std::strerror(errno);
+    return false;
+  }
+
+  std::string old_hash = stored_hash(final_path);
+  if (::rename(tmp.c_str(), final_path.c_str()) < 0) {
+    err = std::string("rename: ") + std::strerror(errno);
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  if (old_hash != sha_hex) release_blob(cfg, old_hash);
+  return true;
+}
+
+bool cas_commit(const ServerConfig& cfg, const fs::path& temp, const std::string& sha_hex,
+                const fs::path& final_path, bool& deduplicated, std::string& err) {
+  fs::path blob = cas_blob_path(cfg, sha_hex);
+  std::error_code ec;
+  fs::create_directories(blob.parent_path(), ec);
+
+  std::lock_guard<std::mutex> lk(g_cas_mu);
+  deduplicated = ::access(blob.c_str(), F_OK) == 0;
+  if (deduplicated) {
+    ::unlink(temp.c_str());
+  } else if (::rename(temp.c_str(), blob.c_str()) < 0) {
+    err = std::string("rename into store: ") + std::strerror(errno);
+    return false;
+  }
+  return link_name(cfg, blob, sha_hex, final_path, err);
+}
+
+bool cas_link_existing(const ServerConfig& cfg, const std::string& sha_hex, const fs::path& final_path,
+                       std::string& err) {
+  fs::path blob = cas_blob_path(cfg, sha_hex);
+
+  std::lock_guard<std::mutex> lk(g_cas_mu);
+  if (::access(blob.c_str(), F_OK) < 0) return false;
+  return link_name(cfg, blob, sha_hex, final_path, err);
+}
+
+bool cas_remove(const ServerConfig& cfg, const fs::path& final_path, bool& freed, std::string& err) {
+  freed = false;
+
+  std::lock_guard<std::mutex> lk(g_cas_mu);
+  std::string hash = stored_hash(final_path);
+  if (::unlink(final_path.c_str()) < 0) {
+    err = std::strerror(errno);
+    return false;
+  }
+  freed = release_blob(cfg, hash);
+  return true;
+}
+
+}
@@ -35,6 +35,102 @@ static bool get_bool(const json& j, const char* key, bool def) {
   return j.at(key).get<bool>();
 }
 
+static uint32_t get_u32(const json& j, const char* key, uint32_t def) {
+  auto v = get_u64(j, key, def);
+  if (v > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error(std::string("config key too large: ") + key);
+  }
+  return static_cast<uint32_t>(v);
+}
+
+static ListenerConfig parse_listener(const json& j, const ListenerConfig& def) {
+  if (!j.is_object()) throw std::runtime_error("listeners entries must be JSON objects");
+
+  ListenerConfig lc = def;
+
+  if (j.contains("path")) {
+    lc.kind = ListenerConfig::Kind::UNIX;
+    lc.path = get_str(j, "path", "");
+    if (lc.path.empty()) throw std::runtime_error("listener path must not be empty");
+    if (lc.path.size() >= 108) throw std::runtime_error("listener path too long: " + lc.path);
+  } else {
+    lc.kind = ListenerConfig::Kind::TCP;
+    lc.address = get_str(j, "address", lc.address);
+    if (lc.address.empty()) throw std::runtime_error("listener address must not be empty");
+
+    auto p = get_u64(j, "port", lc.port);
+    if (p == 0 || p > 65535) throw std::runtime_error("listener port must be 1..65535");
+    lc.port = static_cast<uint16_t>(p);
+
+    lc.ipv6_only = get_bool(j, "ipv6_only", lc.ipv6_only);
+    lc.tcp_nodelay = get_bool(j, "tcp_nodelay", lc.tcp_nodelay);
+    lc.tcp_defer_accept_sec = get_u32(j, "tcp_defer_accept_sec", lc.tcp_defer_accept_sec);
+    lc.tcp_fastopen_qlen = get_u32(j, "tcp_fastopen_qlen", lc.tcp_fastopen_qlen);
+  }
+
+  lc.backlog = get_u32(j, "backlog", lc.backlog);
+  if (lc.backlog == 0 || lc.backlog > (uint32_t)std::numeric_limits<int>::max()) {
+    throw std::runtime_error("listener backlog must be 1..2147483647");
+  }
+
+  lc.tls = get_bool(j, "tls", lc.tls);
+  lc.admin = get_bool(j, "admin", lc.admin);
+
+  lc.rcvbuf = get_u32(j, "rcvbuf", lc.rcvbuf);
+  lc.sndbuf = get_u32(j, "sndbuf", lc.sndbuf);
+  if (lc.rcvbuf > (uint32_t)std::numeric_limits<int>::max() || lc.sndbuf > (uint32_t)std::numeric_limits<int>::max()) {
+    throw std::runtime_error("listener rcvbuf/sndbuf too large");
+  }
+
+  return lc;
+}
+
+static UpstreamConfig parse_upstream(const json& j) {
+  if (!j.is_object()) throw std::runtime_error("upstreams entries must be JSON objects");
+
+  UpstreamConfig u;
+  if (j.contains("path")) {
+    u.path = get_str(j, "path", "");
+    if (u.path.empty() || u.path.size() >= 108) throw std::runtime_error("upstream path must be 1..107 chars");
+    return u;
+  }
+
+  u.host = get_str(j, "host", "");
+  if (u.host.empty()) throw std::runtime_error("upstream needs host/port or path");
+  auto p = get_u64(j, "port", 0);
+  if (p == 0 || p > 65535) throw std::runtime_error("upstream port must be 1..65535");
+  u.port = static_cast<uint16_t>(p);
+  return u;
+}
+
+static ProxyRouteConfig parse_proxy_route(const json& j) {
+  if (!j.is_object()) throw std::runtime_error("proxy_routes entries must be JSON objects");
+
+  ProxyRouteConfig r;
+  r.prefix = get_str(j, "prefix", "");
+  if (r.prefix.empty() || r.prefix[0] != '/') throw std::runtime_error("proxy route prefix must start with '/'");
+
+  if (!j.contains("upstreams") || !j.at("upstreams").is_array() || j.at("upstreams").empty()) {
+    throw std::runtime_error("proxy route " + r.prefix + " needs a non-empty upstreams array");
+  }
+  for (const auto& u : j.at("upstreams")) r.upstreams.push_back(parse_upstream(u));
+
+  r.strip_prefix = get_bool(j, "strip_prefix", r.strip_prefix);
+  r.pool_size = get_u32(j, "pool_size", r.pool_size);
+  r.connect_timeout_ms = get_u32(j, "connect_timeout_ms", r.connect_timeout_ms);
+  r.timeout_sec = get_u32(j, "timeout_sec", r.timeout_sec);
+  r.health_check_interval_ms = get_u32(j, "health_check_interval_ms", r.health_check_interval_ms);
+  r.health_check_path = get_str(j, "health_check_path", r.health_check_path);
+
+  if (r.connect_timeout_ms == 0 || r.timeout_sec == 0) {
+    throw std::runtime_error("proxy route timeouts must be > 0");
+  }
+  if (!r.health_check_path.empty() && r.health_check_path[0] != '/') {
+    throw std::runtime_error("health_check_path must start with '/'");
+  }
+  return r;
+}
+
 ServerConfig load_config_json(const std::string& path) {
   std::ifstream f(path);
   if (!f) throw std::runtime_error("cannot open config file: " + path);
@@ -66,11 +162,17 @@ ServerConfig load_config_json(const std::string& path) {
     cfg.max_clients = static_cast<uint32_t>(mc);
   }
 
+  cfg.memory_budget_bytes = get_u64(j, "memory_budget_bytes", cfg.memory_budget_bytes);
+
   cfg.root_dir = get_str(j, "root_dir", cfg.root_dir);
 
   cfg.log_file = get_str(j, "log_file", cfg.log_file);
   cfg.log_level = get_str(j, "log_level", cfg.log_level);
 
+  cfg.access_log_file = get_str(j, "access_log_file", cfg.access_log_file);
+  cfg.access_log_sample_every = get_u32(j, "access_log_sample_every", cfg.access_log_sample_every);
+  cfg.access_log_slow_ms = get_u32(j, "access_log_slow_ms", cfg.access_log_slow_ms);
+
   cfg.keep_alive = get_bool(j, "keep_alive", cfg.keep_alive);
 
   {
@@ -101,9 +203,61 @@ ServerConfig load_config_json(const std::string& path) {
     cfg.recv_chunk_size = static_cast<uint32_t>(v);
   }
 
+  cfg.drain_timeout_sec = get_u32(j, "drain_timeout_sec", cfg.drain_timeout_sec);
+
+  cfg.upload_max_part_bytes = get_u64(j, "upload_max_part_bytes", cfg.upload_max_part_bytes);
+  cfg.upload_max_total_bytes = get_u64(j, "upload_max_total_bytes", cfg.upload_max_total_bytes);
+  if (cfg.upload_max_part_bytes == 0 || cfg.upload_max_total_bytes == 0) {
+    throw std::runtime_error("upload_max_part_bytes and upload_max_total_bytes must be > 0");
+  }
+
+  cfg.upload_digest_sha256 = get_bool(j, "upload_digest_sha256", cfg.upload_digest_sha256);
+
+  cfg.storage_mode = get_str(j, "storage_mode", cfg.storage_mode);
+  if (cfg.storage_mode != "plain" && cfg.storage_mode != "cas") {
+    throw std::runtime_error("storage_mode must be \"plain\" or \"cas\"");
+  }
+
+  cfg.upload_max_sessions = get_u32(j, "upload_max_sessions", cfg.upload_max_sessions);
+  if (cfg.upload_max_sessions == 0) throw std::runtime_error("upload_max_sessions must be > 0");
+  cfg.upload_session_ttl_sec = get_u32(j, "upload_session_ttl_sec", cfg.upload_session_ttl_sec);
+  if (cfg.upload_session_ttl_sec == 0) throw std::runtime_error("upload_session_ttl_sec must be > 0");
+
+  cfg.tls_cert_file = get_str(j, "tls_cert_file", cfg.tls_cert_file);
+  cfg.tls_key_file = get_str(j, "tls_key_file", cfg.tls_key_file);
+  cfg.tls_session_tickets = get_bool(j, "tls_session_tickets", cfg.tls_session_tickets);
+  cfg.tls_session_cache_size = get_u32(j, "tls_session_cache_size", cfg.tls_session_cache_size);
+  cfg.tls_ktls = get_bool(j, "tls_ktls", cfg.tls_ktls);
+
+  if (j.contains("proxy_routes")) {
+    if (!j.at("proxy_routes").is_array()) throw std::runtime_error("proxy_routes must be an array");
+    for (const auto& r : j.at("proxy_routes")) cfg.proxy_routes.push_back(parse_proxy_route(r));
+  }
+
   if (cfg.server_ip.empty()) throw std::runtime_error("server_ip must not be empty");
   if (cfg.root_dir.empty()) throw std::runtime_error("root_dir must not be empty");
 
+  {
+    ListenerConfig def;
+    def.address = cfg.server_ip;
+    def.port = cfg.port;
+
+    if (j.contains("listeners")) {
+      const auto& arr = j.at("listeners");
+      if (!arr.is_array()) throw std::runtime_error("listeners must be an array");
+      if (arr.empty()) throw std::runtime_error("listeners must not be empty");
+      for (const auto& e : arr) cfg.listeners.push_back(parse_listener(e, def));
+    } else {
+      cfg.listeners.push_back(def);
+    }
+  }
+
+  for (const auto& lc : cfg.listeners) {
+    if (lc.tls && (cfg.tls_cert_file.empty() || cfg.tls_key_file.empty())) {
+      throw std::runtime_error("tls listeners need tls_cert_file and tls_key_file");
+    }
+  }
+
   return cfg;
 }
 
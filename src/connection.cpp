@@ -0,0 +1,169 @@
+#include "connection.hpp"
+#include "memory_budget.hpp"
+#include "net.hpp"
+#include "tls.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <limits>
+#include <vector>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+Connection::Connection(int fd, std::string peer) : fd_(fd), peer_(std::move(peer)) {}
+
+Connection::~Connection() {
+  if (ssl_) {
+    // Best effort close_notify; the socket is non-blocking, so this never waits.
+    ERR_clear_error();
+    SSL_shutdown(ssl_);
+    SSL_free(ssl_);
+  }
+  close_quiet(fd_);
+}
+
+void Connection::set_timeout_sec(uint32_t sec) {
+  uint64_t ms = (uint64_t)sec * 1000;
+  if (ms > (uint64_t)std::numeric_limits<int>::max()) ms = std::numeric_limits<int>::max();
+  timeout_ms_ = (int)ms;
+}
+
+bool Connection::wait_tls(int ssl_error) {
+  short events;
+  if (ssl_error == SSL_ERROR_WANT_READ) events = POLLIN;
+  else if (ssl_error == SSL_ERROR_WANT_WRITE) events = POLLOUT;
+  else return false;
+
+  int w = wait_fd(fd_, events, timeout_ms_);
+  if (w == 0) errno = ETIMEDOUT;
+  return w > 0;
+}
+
+bool Connection::start_tls(SSL_CTX* ctx, std::string& err) {
+  ERR_clear_error();
+  ssl_ = SSL_new(ctx);
+  if (!ssl_ || SSL_set_fd(ssl_, fd_) != 1) {
+    err = tls_error_string();
+    return false;
+  }
+
+  while (true) {
+    ERR_clear_error();
+    int r = SSL_accept(ssl_);
+    if (r == 1) break;
+
+    int e = SSL_get_error(ssl_, r);
+    if (!wait_tls(e)) {
+      err = (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) ? "handshake timed out" : tls_error_string();
+      return false;
+    }
+  }
+
+  ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_)) != 0;
+  ktls_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_)) != 0;
+  return true;
+}
+
+int Connection::wait_readable(int timeout_ms) {
+  if (ssl_ && SSL_has_pending(ssl_)) return 1;
+  return wait_fd(fd_, POLLIN, timeout_ms);
+}
+
+ssize_t Connection::recv_some(void* buf, size_t len) {
+  if (!ssl_) return ::minihttpd::recv_some(fd_, buf, len, timeout_ms_);
+
+  while (true) {
+    size_t n = 0;
+    ERR_clear_error();
+    int r = SSL_read_ex(ssl_, buf, len, &n);
+    if (r == 1) return (ssize_t)n;
+
+    int e = SSL_get_error(ssl_, r);
+    if (e == SSL_ERROR_ZERO_RETURN) return 0;
+    if (!wait_tls(e)) return -1;
+  }
+}
+
+bool Connection::send_all(const void* data, size_t len) {
+  if (!ssl_) {
+    if (!::minihttpd::send_all(fd_, data, len, timeout_ms_)) return false;
+    bytes_sent_ += len;
+    return true;
+  }
+
+  const char* p = static_cast<const char*>(data);
+  size_t left = len;
+  while (left > 0) {
+    size_t n = 0;
+    ERR_clear_error();
+    int r = SSL_write_ex(ssl_, p, left, &n);
+    if (r == 1) {
+      p += n;
+      left -= n;
+      continue;
+    }
+    if (!wait_tls(SSL_get_error(ssl_, r))) return false;
+  }
+  bytes_sent_ += len;
+  return true;
+}
+
+bool Connection::send_string(const std::string& s) {
+  return send_all(s.data(), s.size());
+}
+
+bool Connection::send_file(int file_fd, uint64_t offset, uint64_t len) {
+  if (!ssl_) {
+    if (!send_file_all(fd_, file_fd, offset, len, timeout_ms_)) return false;
+    bytes_sent_ += len;
+    return true;
+  }
+
+  if (ktls_send_) {
+    const uint64_t total = len;
+    while (len > 0) {
+      size_t chunk = (size_t)std::min<uint64_t>(len, 1u << 30);
+      ERR_clear_error();
+      ossl_ssize_t n = SSL_sendfile(ssl_, file_fd, (off_t)offset, chunk, 0);
+      if (n > 0) {
+        offset += (uint64_t)n;
+        len -= (uint64_t)n;
+        continue;
+      }
+      if (n == 0 || !wait_tls(SSL_get_error(ssl_, (int)n))) return false;
+    }
+    bytes_sent_ += total;
+    return true;
+  }
+
+  // Userspace TLS: the file has to pass through OpenSSL to be encrypted.
+  // Over budget, fall back to one TLS record at a time from the stack.
+  MemCharge mem(MemCategory::Responses);
+  std::vector<char> heap;
+  char small[16384];
+  char* buf = small;
+  size_t cap = sizeof(small);
+  size_t want_cap = (size_t)std::min<uint64_t>(len, 256 * 1024);
+  if (want_cap > cap && mem_reserve(mem, want_cap)) {
+    heap.resize(want_cap);
+    buf = heap.data();
+    cap = heap.size();
+  }
+  while (len > 0) {
+    size_t want = (size_t)std::min<uint64_t>(len, cap);
+    ssize_t n = ::pread(file_fd, buf, want, (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    if (!send_all(buf, (size_t)n)) return false;
+    offset += (uint64_t)n;
+    len -= (uint64_t)n;
+  }
+  return true;
+}
+
+}
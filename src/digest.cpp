@@ -0,0 +1,219 @@
+#include "digest.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <new>
+
+#include <openssl/evp.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace minihttpd {
+
+static uint32_t g_crc32c_table[256];
+
+static bool init_crc32c_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : (c >> 1);
+    g_crc32c_table[i] = c;
+  }
+  return true;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+  static const bool init = init_crc32c_table();
+  (void)init;
+  while (len--) crc = g_crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+  while (len && ((uintptr_t)p & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    len--;
+  }
+  uint64_t c = crc;
+  while (len >= 32) {
+    uint64_t w0, w1, w2, w3;
+    std::memcpy(&w0, p, 8);
+    std::memcpy(&w1, p + 8, 8);
+    std::memcpy(&w2, p + 16, 8);
+    std::memcpy(&w3, p + 24, 8);
+    c = _mm_crc32_u64(c, w0);
+    c = _mm_crc32_u64(c, w1);
+    c = _mm_crc32_u64(c, w2);
+    c = _mm_crc32_u64(c, w3);
+    p += 32;
+    len -= 32;
+  }
+  while (len >= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)c;
+  while (len--) crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+#endif
+
+bool Crc32c::hardware_accelerated() {
+#if defined(__x86_64__)
+  static const bool hw = __builtin_cpu_supports("sse4.2");
+  return hw;
+#else
+  return false;
+#endif
+}
+
+void Crc32c::update(const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+#if defined(__x86_64__)
+  if (hardware_accelerated()) {
+    state_ = crc32c_hw(state_, p, len);
+    return;
+  }
+#endif
+  state_ = crc32c_sw(state_, p, len);
+}
+
+Sha256::Sha256() : ctx_(EVP_MD_CTX_new()) {
+  if (!ctx_ || EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr) != 1) throw std::bad_alloc();
+}
+
+Sha256::~Sha256() {
+  EVP_MD_CTX_free(ctx_);
+}
+
+void Sha256::update(const void* data, size_t len) {
+  EVP_DigestUpdate(ctx_, data, len);
+}
+
+std::array<uint8_t, 32> Sha256::finish() {
+  std::array<uint8_t, 32> out{};
+  unsigned int n = 0;
+  EVP_DigestFinal_ex(ctx_, out.data(), &n);
+  return out;
+}
+
+std::string base64_encode(const void* data, size_t len) {
+  static const char* tbl = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const uint8_t* p = (const uint8_t*)data;
+
+  std::string out;
+  out.reserve((len + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < len; i += 3) {
+    uint32_t v = (uint32_t)p[i] << 16 | (uint32_t)p[i + 1] << 8 | p[i + 2];
+    out.push_back(tbl[v >> 18]);
+    out.push_back(tbl[(v >> 12) & 63]);
+    out.push_back(tbl[(v >> 6) & 63]);
+    out.push_back(tbl[v & 63]);
+  }
+  if (i < len) {
+    uint32_t v = (uint32_t)p[i] << 16 | (i + 1 < len ? (uint32_t)p[i + 1] << 8 : 0);
+    out.push_back(tbl[v >> 18]);
+    out.push_back(tbl[(v >> 12) & 63]);
+    out.push_back(i + 1 < len ? tbl[(v >> 6) & 63] : '=');
+    out.push_back('=');
+  }
+  return out;
+}
+
+bool base64_decode(const std::string& in, std::string& out) {
+  out.clear();
+  uint32_t acc = 0;
+  int bits = 0;
+  size_t pad = 0;
+  for (char c : in) {
+    int v;
+    if (c >= 'A' && c <= 'Z') v = c - 'A';
+    else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+    else if (c >= '0' && c <= '9') v = c - '0' + 52;
+    else if (c == '+' || c == '-') v = 62;
+    else if (c == '/' || c == '_') v = 63;
+    else if (c == '=') { pad++; continue; }
+    else return false;
+    if (pad) return false;
+
+    acc = (acc << 6) | (uint32_t)v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out.push_back((char)((acc >> bits) & 0xFF));
+    }
+  }
+  return pad <= 2;
+}
+
+std::string hex_encode(const void* data, size_t len) {
+  static const char* hex = "0123456789abcdef";
+  const uint8_t* p = (const uint8_t*)data;
+  std::string out;
+  out.reserve(len * 2);
+  for (size_t i = 0; i < len; i++) {
+    out.push_back(hex[p[i] >> 4]);
+    out.push_back(hex[p[i] & 15]);
+  }
+  return out;
+}
+
+std::string crc32c_b64(uint32_t crc) {
+  uint8_t be[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+  return base64_encode(be, sizeof(be));
+}
+
+DigestValues parse_digest_header(const std::string& v) {
+  DigestValues d;
+  size_t pos = 0;
+  while (pos <= v.size()) {
+    size_t comma = v.find(',', pos);
+    if (comma == std::string::npos) comma = v.size();
+
+    std::string item = trim(v.substr(pos, comma - pos));
+    auto eq = item.find('=');
+    if (eq != std::string::npos) {
+      std::string alg = to_lower(trim(item.substr(0, eq)));
+      std::string val = trim(item.substr(eq + 1));
+      if (alg == "crc32c") d.crc32c = val;
+      else if (alg == "sha-256") d.sha256 = val;
+    }
+    pos = comma + 1;
+  }
+  return d;
+}
+
+std::string format_digest_header(const DigestValues& d) {
+  std::string out;
+  if (!d.crc32c.empty()) out += "crc32c=" + d.crc32c;
+  if (!d.sha256.empty()) {
+    if (!out.empty()) out += ",";
+    out += "sha-256=" + d.sha256;
+  }
+  return out;
+}
+
+bool want_digest_has(const std::string& want_digest, const std::string& alg) {
+  size_t pos = 0;
+  std::string w = to_lower(want_digest);
+  while (pos <= w.size()) {
+    size_t comma = w.find(',', pos);
+    if (comma == std::string::npos) comma = w.size();
+    std::string item = w.substr(pos, comma - pos);
+    auto semi = item.find(';');
+    if (trim(item.substr(0, semi)) == alg) {
+      return semi == std::string::npos || trim(item.substr(semi + 1)) != "q=0";
+    }
+    pos = comma + 1;
+  }
+  return false;
+}
+
+}
@@ -0,0 +1,409 @@
+#include "dirlist.hpp"
+#include "cas.hpp"
+#include "json_util.hpp"
+#include "logger.hpp"
+#include "memory_budget.hpp"
+#include "response.hpp"
+#include "utils.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+static constexpr size_t kDefaultLimit = 1000;
+static constexpr size_t kMaxLimit = 100000;
+static constexpr size_t kCacheMaxBytes = 64u << 20;
+
+// A change within the same timestamp tick as a snapshot build would go
+// unnoticed, so directories modified this recently are listed uncached.
+static constexpr time_t kRacyWindowSec = 2;
+
+namespace {
+
+// One directory's visible names in a single allocation: per entry the d_type
+// byte, the name and a NUL, addressed through offsets sorted by name. Half
+// a million entries cost roughly their name bytes plus 4 bytes each.
+struct DirSnapshot {
+  dev_t dev = 0;
+  ino_t ino = 0;
+  timespec mtime{};
+  timespec ctime{};
+  std::string arena;
+  std::vector<uint32_t> index;
+  MemCharge mem{MemCategory::DirListings};
+
+  const char* name(size_t i) const { return arena.data() + index[i] + 1; }
+  unsigned char type(size_t i) const { return (unsigned char)arena[index[i]]; }
+  size_t bytes() const { return sizeof(*this) + arena.capacity() + index.capacity() * sizeof(uint32_t); }
+};
+
+using SnapshotPtr = std::shared_ptr<const DirSnapshot>;
+
+std::mutex g_cache_mu;
+std::list<SnapshotPtr> g_cache;  // most recently used first
+size_t g_cache_bytes = 0;
+
+}
+
+static bool is_internal_name(std::string_view name) {
+  return name == "." || name == ".." || name == kCasDir || is_temp_name(name);
+}
+
+// Calls fn(name, d_type, d_off) for each visible entry until it returns
+// false. ".", "..", the .cas store and temp files are hidden; other dotfiles
+// are listed.
+template <class Fn>
+static bool for_each_dirent(int fd, Fn&& fn) {
+  alignas(struct dirent64) char buf[64 * 1024];
+  for (;;) {
+    ssize_t n = ::getdents64(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) return true;
+
+    for (ssize_t pos = 0; pos < n;) {
+      auto* d = reinterpret_cast<struct dirent64*>(buf + pos);
+      pos += d->d_reclen;
+      if (is_internal_name(d->d_name)) continue;
+      if (!fn(d->d_name, d->d_type, d->d_off)) return true;
+    }
+  }
+}
+
+static bool same_time(const timespec& a, const timespec& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static SnapshotPtr cache_lookup(const struct stat& st) {
+  std::lock_guard<std::mutex> lk(g_cache_mu);
+  for (auto it = g_cache.begin(); it != g_cache.end(); ++it) {
+    const DirSnapshot& s = **it;
+    if (s.dev != st.st_dev || s.ino != st.st_ino) continue;
+
+    if (same_time(s.mtime, st.st_mtim) && same_time(s.ctime, st.st_ctim)) {
+      g_cache.splice(g_cache.begin(), g_cache, it);
+      return *it;
+    }
+    g_cache_bytes -= s.bytes();
+    g_cache.erase(it);
+    return nullptr;
+  }
+  return nullptr;
+}
+
+static void cache_insert(const SnapshotPtr& s) {
+  if (s->bytes() > kCacheMaxBytes / 2 || mem_pressure()) return;
+
+  std::lock_guard<std::mutex> lk(g_cache_mu);
+  for (auto it = g_cache.begin(); it != g_cache.end(); ++it) {
+    if ((*it)->dev == s->dev && (*it)->ino == s->ino) {
+      g_cache_bytes -= (*it)->bytes();
+      g_cache.erase(it);
+      break;
+    }
+  }
+  g_cache.push_front(s);
+  g_cache_bytes += s->bytes();
+
+  while (g_cache_bytes > kCacheMaxBytes) {
+    g_cache_bytes -= g_cache.back()->bytes();
+    g_cache.pop_back();
+  }
+}
+
+static SnapshotPtr build_snapshot(int fd, const struct stat& st) {
+  auto s = std::make_shared<DirSnapshot>();
+  s->dev = st.st_dev;
+  s->ino = st.st_ino;
+  s->mtime = st.st_mtim;
+  s->ctime = st.st_ctim;
+
+  if (::lseek(fd, 0, SEEK_SET) < 0) return nullptr;
+
+  // Growth is reserved against the budget before the vectors reallocate;
+  // while they do, the old and the new buffer both exist.
+  bool no_mem = false;
+  auto grow = [&](size_t extra) {
+    size_t acap = s->arena.capacity(), icap = s->index.capacity();
+    bool ga = s->arena.size() + extra > acap, gi = s->index.size() == icap;
+    if (!ga && !gi) return true;
+    if (ga) acap = std::max(s->arena.size() + extra, acap * 2);
+    if (gi) icap = std::max<size_t>(256, icap * 2);
+    uint64_t need = s->bytes() + (ga ? acap : 0) + (gi ? icap * sizeof(uint32_t) : 0);
+    if (!mem_reserve(s->mem, need)) return false;
+    if (ga) s->arena.reserve(acap);
+    if (gi) s->index.reserve(icap);
+    s->mem.resize(s->bytes());
+    return true;
+  };
+
+  bool fits = true;
+  bool ok = for_each_dirent(fd, [&](const char* name, unsigned char type, int64_t) {
+    if (s->arena.size() > UINT32_MAX - 512) {
+      fits = false;
+      return false;
+    }
+    if (type == DT_UNKNOWN) {
+      struct stat est{};
+      if (::fstatat(fd, name, &est, AT_SYMLINK_NOFOLLOW) == 0) type = IFTODT(est.st_mode);
+    }
+    if (!grow(std::strlen(name) + 2)) {
+      no_mem = true;
+      return false;
+    }
+    s->index.push_back((uint32_t)s->arena.size());
+    s->arena.push_back((char)type);
+    s->arena.append(name);
+    s->arena.push_back('\0');
+    return true;
+  });
+  if (no_mem) errno = ENOMEM;
+  if (!ok || !fits || no_mem) return nullptr;
+
+  const char* base = s->arena.data();
+  std::sort(s->index.begin(), s->index.end(),
+            [base](uint32_t a, uint32_t b) { return std::strcmp(base + a + 1, base + b + 1) < 0; });
+  s->arena.shrink_to_fit();
+  s->index.shrink_to_fit();
+  s->mem.resize(s->bytes());
+  return s;
+}
+
+uint64_t dirlist_cache_trim(uint64_t want) {
+  std::lock_guard<std::mutex> lk(g_cache_mu);
+  uint64_t freed = 0;
+  while (freed < want && !g_cache.empty()) {
+    size_t b = g_cache.back()->bytes();
+    g_cache_bytes -= b;
+    freed += b;
+    g_cache.pop_back();
+  }
+  return freed;
+}
+
+static SnapshotPtr get_snapshot(int fd, const struct stat& st) {
+  if (auto s = cache_lookup(st)) return s;
+
+  SnapshotPtr s = build_snapshot(fd, st);
+  if (s && std::time(nullptr) - st.st_mtim.tv_sec >= kRacyWindowSec) cache_insert(s);
+  return s;
+}
+
+static const char* type_name(unsigned char t) {
+  switch (t) {
+    case DT_REG: return "file";
+    case DT_DIR: return "dir";
+    case DT_LNK: return "symlink";
+    default: return "other";
+  }
+}
+
+static std::string json_string(const std::string& s) {
+  return dump_json(nlohmann::json(s));
+}
+
+namespace {
+
+// Formats entries straight into the response as they are produced.
+struct ListingWriter {
+  ChunkedWriter& w;
+  int dir_fd;
+  bool json;
+  bool with_stat;
+  size_t count = 0;
+  std::string line;
+
+  bool entry(const char* name, unsigned char type) {
+    struct stat st{};
+    bool have_stat = with_stat && ::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+
+    line.clear();
+    if (json) {
+      if (count) line += ",";
+      line += "{\"name\":" + json_string(name) + ",\"type\":\"" + type_name(type) + "\"";
+      if (have_stat) {
+        line += ",\"size\":" + std::to_string(st.st_size);
+        line += ",\"mtime\":" + std::to_string(st.st_mtim.tv_sec);
+      }
+      line += "}";
+    } else {
+      std::string shown = std::string(name) + (type == DT_DIR ? "/" : "");
+      line += "<li><a href=\"" + html_escape(url_encode(shown)) + "\">" + html_escape(shown) + "</a>";
+      if (have_stat) {
+        char when[32];
+        struct tm tm{};
+        gmtime_r(&st.st_mtim.tv_sec, &tm);
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        line += " <small>" + std::to_string(st.st_size) + " bytes, " + when + " UTC</small>";
+      }
+      line += "</li>\n";
+    }
+    count++;
+    return w.write(line);
+  }
+};
+
+}
+
+static bool parse_size(const std::string& s, uint64_t& out) {
+  auto r = std::from_chars(s.data(), s.data() + s.size(), out);
+  return !s.empty() && r.ec == std::errc() && r.ptr == s.data() + s.size();
+}
+
+void handle_dir_listing(RequestContext& ctx, int dir_fd, const std::string& url_path, const std::string& query) {
+  bool ka = ctx.reply_keep_alive();
+
+  // Relative links in the listing need the trailing slash.
+  if (url_path.empty() || url_path.back() != '/') {
+    HttpResponseHead head;
+    head.status = 301;
+    head.headers["Location"] = url_encode(url_path) + "/" + (query.empty() ? "" : "?" + query);
+    send_response(ctx.conn, std::move(head), "", ka);
+    return;
+  }
+
+  std::string v;
+  uint64_t limit = kDefaultLimit;
+  if (query_param(query, "limit", v) && (!parse_size(v, limit) || limit == 0)) {
+    send_error(ctx.conn, 400, ka, "limit must be a positive integer");
+    return;
+  }
+  limit = std::min<uint64_t>(limit, kMaxLimit);
+
+  bool with_stat = query_param(query, "stat", v) && (v == "1" || v == "true");
+
+  bool json;
+  if (query_param(query, "format", v)) {
+    json = v == "json";
+  } else {
+    auto a = ctx.req.headers.find("accept");
+    json = a != ctx.req.headers.end() && a->second.find("application/json") != std::string::npos;
+  }
+
+  bool disk_order = query_param(query, "order", v) && v == "disk";
+  uint64_t cursor = 0;
+  if (disk_order && query_param(query, "cursor", v) && !parse_size(v, cursor)) {
+    send_error(ctx.conn, 400, ka, "invalid cursor");
+    return;
+  }
+
+  struct stat st{};
+  if (::fstat(dir_fd, &st) < 0) {
+    send_error(ctx.conn, 500, ka);
+    return;
+  }
+
+  SnapshotPtr snap;
+  size_t begin = 0, end = 0;
+  if (!disk_order) {
+    snap = get_snapshot(dir_fd, st);
+    if (!snap && errno == ENOMEM) {
+      LOG_WARN("Memory budget exhausted, not listing " + url_path + " -> 503");
+      send_error(ctx.conn, 503, ka, "server is out of memory budget, retry later");
+      return;
+    }
+    if (!snap) {
+      LOG_ERROR("Cannot list directory " + url_path + ": " + std::strerror(errno));
+      send_error(ctx.conn, 500, ka, "cannot read directory");
+      return;
+    }
+    if (query_param(query, "after", v)) {
+      const char* base = snap->arena.data();
+      begin = (size_t)(std::upper_bound(snap->index.begin(), snap->index.end(), v,
+                                        [base](const std::string& key, uint32_t off) {
+                                          return std::strcmp(key.c_str(), base + off + 1) < 0;
+                                        }) -
+                       snap->index.begin());
+    }
+    end = std::min<size_t>(snap->index.size(), begin + (size_t)limit);
+  } else if (::lseek(dir_fd, (off_t)cursor, SEEK_SET) < 0) {
+    send_error(ctx.conn, 400, ka, "invalid cursor");
+    return;
+  }
+
+  bool chunked = ctx.req.version == "HTTP/1.1";
+  if (!chunked) ctx.force_close = true;
+
+  HttpResponseHead head;
+  head.status = 200;
+  head.headers["Content-Type"] = json ? "application/json; charset=utf-8" : "text/html; charset=utf-8";
+  head.headers["Cache-Control"] = "no-cache";
+  if (!send_stream_head(ctx.conn, std::move(head), chunked, ka)) return;
+  if (ctx.req.method == "HEAD") return;
+
+  ChunkedWriter w(ctx.conn, chunked);
+  if (json) {
+    w.write("{\"path\":" + json_string(url_path) + ",\"order\":\"" + (disk_order ? "disk" : "name") + "\"");
+    if (snap) w.write(",\"total\":" + std::to_string(snap->index.size()));
+    w.write(",\"entries\":[");
+  } else {
+    std::string title = "Index of " + html_escape(url_path);
+    w.write("<!doctype html><html><head><meta charset=\"utf-8\"/><title>" + title +
+            "</title></head><body style=\"font-family:sans-serif;\"><h1>" + title + "</h1>\n<ul>\n");
+    if (url_path != "/") w.write("<li><a href=\"../\">../</a></li>\n");
+  }
+
+  ListingWriter out{w, dir_fd, json, with_stat, 0, {}};
+  bool has_next = false;
+  std::string next;
+
+  if (snap) {
+    for (size_t i = begin; i < end; i++) {
+      if (!out.entry(snap->name(i), snap->type(i))) return;
+    }
+    has_next = end < snap->index.size();
+    if (has_next) next = snap->name(end - 1);
+  } else {
+    bool sent = true;
+    int64_t last_off = 0;
+    bool ok = for_each_dirent(dir_fd, [&](const char* name, unsigned char type, int64_t off) {
+      if (out.count == limit) {
+        has_next = true;
+        return false;
+      }
+      last_off = off;
+      sent = out.entry(name, type);
+      return sent;
+    });
+    if (!sent) return;
+    if (!ok) {
+      LOG_WARN("getdents64 failed while listing " + url_path + ": " + std::strerror(errno));
+      ctx.force_close = true;
+      return;
+    }
+    if (has_next) next = std::to_string(last_off);
+  }
+
+  if (json) {
+    w.write(std::string("],\"next\":") + (has_next ? json_string(next) : "null") + "}");
+  } else {
+    w.write("</ul>\n");
+    if (has_next) {
+      std::string href = "?" + std::string(disk_order ? "order=disk&cursor=" : "after=") + url_encode(next) +
+                         "&limit=" + std::to_string(limit) + (with_stat ? "&stat=1" : "");
+      w.write("<p><a href=\"" + html_escape(href) + "\">Next page</a></p>\n");
+    }
+    w.write("</body></html>\n");
+  }
+  w.finish();
+}
+
+}
@@ -0,0 +1,190 @@
+#include "handoff.hpp"
+#include "net.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+static constexpr size_t kMaxHandoffFds = 253;   // SCM_MAX_FD
+static constexpr size_t kMaxNamesBytes = 65536;
+
+pid_t spawn_upgrade(const std::vector<std::string>& argv, int& parent_sock, std::string& err) {
+  parent_sock = -1;
+  if (argv.empty()) { err = "no argv to exec"; return -1; }
+
+  int sv[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    err = std::string("socketpair(): ") + std::strerror(errno);
+    return -1;
+  }
+
+  // Build everything the child needs before fork(): only async-signal-safe
+  // calls are allowed between fork() and exec() in a threaded process.
+  std::vector<char*> cargv;
+  for (const auto& a : argv) cargv.push_back(const_cast<char*>(a.c_str()));
+  cargv.push_back(nullptr);
+
+  std::string env_kv = std::string(kHandoffEnv) + "=" + std::to_string(sv[1]);
+  std::string env_prefix = std::string(kHandoffEnv) + "=";
+  std::vector<char*> cenv;
+  for (char** e = environ; *e; e++) {
+    if (std::strncmp(*e, env_prefix.c_str(), env_prefix.size()) == 0) continue;
+    cenv.push_back(*e);
+  }
+  cenv.push_back(const_cast<char*>(env_kv.c_str()));
+  cenv.push_back(nullptr);
+
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    err = std::string("fork(): ") + std::strerror(errno);
+    close_quiet(sv[0]);
+    close_quiet(sv[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    ::fcntl(sv[1], F_SETFD, 0);
+
+    sigset_t none;
+    sigemptyset(&none);
+    ::sigprocmask(SIG_SETMASK, &none, nullptr);
+
+    ::execvpe(cargv[0], cargv.data(), cenv.data());
+    ::_exit(127);
+  }
+
+  close_quiet(sv[1]);
+  parent_sock = sv[0];
+  return pid;
+}
+
+bool send_listeners(int sock, const std::vector<Listener>& listeners, std::string& err) {
+  if (listeners.empty() || listeners.size() > kMaxHandoffFds) {
+    err = "cannot hand off " + std::to_string(listeners.size()) + " listeners";
+    return false;
+  }
+
+  std::string names;
+  for (const auto& l : listeners) {
+    names += l.name;
+    names.push_back('\n');
+  }
+  if (names.size() > kMaxNamesBytes) { err = "listener names too long"; return false; }
+
+  std::vector<char> ctrl(CMSG_SPACE(sizeof(int) * listeners.size()));
+  iovec iov{names.data(), names.size()};
+
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.data();
+  msg.msg_controllen = ctrl.size();
+
+  cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+  int* fds = (int*)CMSG_DATA(cm);
+  for (size_t i = 0; i < listeners.size(); i++) fds[i] = listeners[i].fd;
+
+  ssize_t n;
+  do {
+    n = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+
+  if (n != (ssize_t)names.size()) {
+    err = std::string("sendmsg(): ") + (n < 0 ? std::strerror(errno) : "short write");
+    return false;
+  }
+  return true;
+}
+
+bool wait_upgrade_ready(int sock, int timeout_ms, std::string& err) {
+  int w = wait_fd(sock, POLLIN, timeout_ms);
+  if (w <= 0) {
+    err = (w == 0) ? "new process did not become ready in time" : std::strerror(errno);
+    return false;
+  }
+
+  char c = 0;
+  ssize_t n;
+  do {
+    n = ::recv(sock, &c, 1, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n != 1 || c != 'R') {
+    err = "new process exited before becoming ready";
+    return false;
+  }
+  return true;
+}
+
+bool receive_listeners(int sock, std::vector<std::pair<std::string, int>>& out, std::string& err) {
+  out.clear();
+
+  std::string names(kMaxNamesBytes, '\0');
+  std::vector<char> ctrl(CMSG_SPACE(sizeof(int) * kMaxHandoffFds));
+  iovec iov{names.data(), names.size()};
+
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.data();
+  msg.msg_controllen = ctrl.size();
+
+  ssize_t n;
+  do {
+    n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    err = std::string("recvmsg(): ") + (n < 0 ? std::strerror(errno) : "peer closed");
+    return false;
+  }
+  names.resize((size_t)n);
+
+  std::vector<int> fds;
+  for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+    size_t cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int* p = (const int*)CMSG_DATA(cm);
+    fds.insert(fds.end(), p, p + cnt);
+  }
+
+  std::vector<std::string> list;
+  size_t pos = 0;
+  while (pos < names.size()) {
+    size_t e = names.find('\n', pos);
+    if (e == std::string::npos) break;
+    list.push_back(names.substr(pos, e - pos));
+    pos = e + 1;
+  }
+
+  if ((msg.msg_flags & MSG_CTRUNC) || list.size() != fds.size()) {
+    for (int fd : fds) close_quiet(fd);
+    err = "malformed listener handoff message";
+    return false;
+  }
+
+  for (size_t i = 0; i < fds.size(); i++) out.emplace_back(list[i], fds[i]);
+  return true;
+}
+
+bool notify_upgrade_ready(int sock) {
+  char c = 'R';
+  ssize_t n;
+  do {
+    n = ::send(sock, &c, 1, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == 1;
+}
+
+}
@@ -26,11 +26,22 @@ std::string http_date_now() {
 std::string status_reason(int status) {
   switch (status) {
     case 200: return "OK";
+    case 201: return "Created";
+    case 301: return "Moved Permanently";
     case 400: return "Bad Request";
     case 403: return "Forbidden";
     case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 415: return "Unsupported Media Type";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
     case 501: return "Not Implemented";
     case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    case 507: return "Insufficient Storage";
     default:  return "Unknown";
   }
 }
@@ -71,11 +82,7 @@ static bool parse_content_length(const std::string& v, uint64_t& out) {
   return true;
 }
 
-bool parse_http_request_headers(const std::string& header_blob, HttpRequest& out, std::string& err) {
-  out = HttpRequest{};
-  err.clear();
-
-  std::vector<std::string> lines;
+static void split_header_lines(const std::string& header_blob, std::vector<std::string>& lines) {
   lines.reserve(32);
 
   size_t pos = 0;
@@ -86,6 +93,55 @@ bool parse_http_request_headers(const std::string& header_blob, HttpRequest& out
     pos = e + 2;
     if (pos >= header_blob.size()) break;
   }
+}
+
+// Header fields after the start line; shared by requests and responses.
+static bool parse_header_fields(
+  const std::vector<std::string>& lines,
+  std::unordered_map<std::string, std::string>& headers,
+  bool& has_content_length,
+  uint64_t& content_length,
+  std::string& err) {
+  for (size_t i = 1; i < lines.size(); i++) {
+    const std::string& ln = lines[i];
+    if (ln.empty()) break;
+
+    auto p = ln.find(':');
+    if (p == std::string::npos) { err = "bad header line"; return false; }
+
+    std::string key = trim(ln.substr(0, p));
+    std::string val = trim(ln.substr(p + 1));
+
+    if (key.empty()) { err = "empty header name"; return false; }
+    for (char c : key) {
+      if (!is_token_char(c)) { err = "invalid header name"; return false; }
+    }
+
+    headers[to_lower(key)] = val;
+  }
+
+  has_content_length = false;
+  auto it = headers.find("content-length");
+  if (it != headers.end()) {
+    uint64_t cl = 0;
+    if (!parse_content_length(it->second, cl)) {
+      err = "bad content-length";
+      return false;
+    }
+    content_length = cl;
+    has_content_length = true;
+  }
+
+  return true;
+}
+
+bool parse_http_request_headers(const std::string& header_blob, HttpRequest& out, std::string& err, int& status) {
+  out = HttpRequest{};
+  err.clear();
+  status = 400;
+
+  std::vector<std::string> lines;
+  split_header_lines(header_blob, lines);
 
   if (lines.empty()) { err = "empty request"; return false; }
   {
@@ -111,33 +167,54 @@ bool parse_http_request_headers(const std::string& header_blob, HttpRequest& out
     }
   }
 
-  for (size_t i = 1; i < lines.size(); i++) {
-    const std::string& ln = lines[i];
-    if (ln.empty()) break;
+  bool has_cl = false;
+  if (!parse_header_fields(lines, out.headers, has_cl, out.content_length, err)) return false;
 
-    auto p = ln.find(':');
-    if (p == std::string::npos) { err = "bad header line"; return false; }
+  if (out.headers.count("transfer-encoding")) {
+    if (has_cl) {
+      err = "both transfer-encoding and content-length";
+      return false;
+    }
+    err = "transfer-encoding is not supported";
+    status = 501;
+    return false;
+  }
+  return true;
+}
 
-    std::string key = trim(ln.substr(0, p));
-    std::string val = trim(ln.substr(p + 1));
+bool parse_http_response_headers(const std::string& header_blob, HttpResponse& out, std::string& err) {
+  out = HttpResponse{};
+  err.clear();
 
-    if (key.empty()) { err = "empty header name"; return false; }
-    for (char c : key) {
-      if (!is_token_char(c)) { err = "invalid header name"; return false; }
+  std::vector<std::string> lines;
+  split_header_lines(header_blob, lines);
+
+  if (lines.empty()) { err = "empty response"; return false; }
+  {
+    const std::string& sl = lines[0];
+    auto sp1 = sl.find(' ');
+    if (sp1 == std::string::npos) { err = "invalid status line"; return false; }
+    out.version = sl.substr(0, sp1);
+    if (out.version != "HTTP/1.1" && out.version != "HTTP/1.0") {
+      err = "unsupported http version";
+      return false;
     }
 
-    out.headers[to_lower(key)] = val;
-  }
-  auto it = out.headers.find("content-length");
-  if (it != out.headers.end()) {
-    uint64_t cl = 0;
-    if (!parse_content_length(it->second, cl)) {
-      err = "bad content-length";
+    auto sp2 = sl.find(' ', sp1 + 1);
+    std::string code = sl.substr(sp1 + 1, (sp2 == std::string::npos) ? std::string::npos : sp2 - sp1 - 1);
+    if (code.size() != 3 || !std::isdigit((unsigned char)code[0]) ||
+        !std::isdigit((unsigned char)code[1]) || !std::isdigit((unsigned char)code[2])) {
+      err = "invalid status code";
       return false;
     }
-    out.content_length = cl;
+    out.status = std::stoi(code);
+    out.reason = (sp2 == std::string::npos) ? "" : sl.substr(sp2 + 1);
   }
 
+  if (!parse_header_fields(lines, out.headers, out.has_content_length, out.content_length, err)) return false;
+
+  auto te = out.headers.find("transfer-encoding");
+  out.chunked = te != out.headers.end() && to_lower(te->second).find("chunked") != std::string::npos;
   return true;
 }
 
@@ -151,4 +228,111 @@ std::string build_response_head(const HttpResponseHead& head) {
   return oss.str();
 }
 
+void split_target(const std::string& target, std::string& path, std::string& query) {
+  auto q = target.find('?');
+  if (q == std::string::npos) {
+    path = url_decode(target);
+    query.clear();
+  } else {
+    path = url_decode(target.substr(0, q));
+    query = target.substr(q + 1);
+  }
+}
+
+bool query_param(const std::string& query, const std::string& key, std::string& out) {
+  size_t pos = 0;
+  while (pos <= query.size()) {
+    size_t amp = query.find('&', pos);
+    if (amp == std::string::npos) amp = query.size();
+
+    std::string item = query.substr(pos, amp - pos);
+    auto eq = item.find('=');
+    std::string k = url_decode(item.substr(0, eq));
+    if (k == key) {
+      out = (eq == std::string::npos) ? "" : url_decode(item.substr(eq + 1));
+      return true;
+    }
+    pos = amp + 1;
+  }
+  return false;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return 10 + (c - 'a');
+  if (c >= 'A' && c <= 'F') return 10 + (c - 'A');
+  return -1;
+}
+
+size_t ChunkedScanner::feed(const char* data, size_t len, std::string* payload) {
+  size_t i = 0;
+  while (i < len && state_ != State::DONE && !bad_) {
+    char c = data[i];
+    switch (state_) {
+      case State::SIZE: {
+        int v = hex_digit(c);
+        if (v >= 0) {
+          if (size_ > (std::numeric_limits<uint64_t>::max() >> 4)) { bad_ = true; break; }
+          size_ = (size_ << 4) | (uint64_t)v;
+          saw_digit_ = true;
+        } else if (c == ';') {
+          state_ = State::EXT;
+        } else if (c == '\r') {
+          state_ = State::SIZE_LF;
+        } else if (c != ' ' && c != '\t') {
+          bad_ = true;
+          break;
+        }
+        i++;
+        break;
+      }
+      case State::EXT:
+        if (c == '\r') state_ = State::SIZE_LF;
+        i++;
+        break;
+      case State::SIZE_LF:
+        if (c != '\n' || !saw_digit_) { bad_ = true; break; }
+        i++;
+        state_ = (size_ == 0) ? State::TRAILER_START : State::DATA;
+        break;
+      case State::DATA: {
+        uint64_t n = len - i;
+        if (n > size_) n = size_;
+        if (payload) payload->append(data + i, (size_t)n);
+        i += (size_t)n;
+        size_ -= n;
+        if (size_ == 0) state_ = State::DATA_CR;
+        break;
+      }
+      case State::DATA_CR:
+        if (c != '\r') { bad_ = true; break; }
+        i++;
+        state_ = State::DATA_LF;
+        break;
+      case State::DATA_LF:
+        if (c != '\n') { bad_ = true; break; }
+        i++;
+        state_ = State::SIZE;
+        saw_digit_ = false;
+        break;
+      case State::TRAILER_START:
+        state_ = (c == '\r') ? State::FINAL_LF : State::TRAILER_LINE;
+        i++;
+        break;
+      case State::TRAILER_LINE:
+        if (c == '\n') state_ = State::TRAILER_START;
+        i++;
+        break;
+      case State::FINAL_LF:
+        if (c != '\n') { bad_ = true; break; }
+        i++;
+        state_ = State::DONE;
+        break;
+      case State::DONE:
+        break;
+    }
+  }
+  return i;
+}
+
 }
@@ -0,0 +1,189 @@
+#include "listener.hpp"
+#include "net.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+std::string listener_name(const ListenerConfig& lc) {
+  if (lc.kind == ListenerConfig::Kind::UNIX) return "unix:" + lc.path;
+  if (lc.address.find(':') != std::string::npos) {
+    return "[" + lc.address + "]:" + std::to_string(lc.port);
+  }
+  return lc.address + ":" + std::to_string(lc.port);
+}
+
+static bool set_int_opt(int fd, int level, int opt, int val, const char* what, std::string& err) {
+  if (::setsockopt(fd, level, opt, &val, sizeof(val)) < 0) {
+    err = std::string(what) + ": " + std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+static bool fail(int fd, std::string& err, const std::string& what) {
+  err = what + ": " + std::strerror(errno);
+  close_quiet(fd);
+  return false;
+}
+
+static bool open_tcp(const ListenerConfig& lc, int& out_fd, std::string& err) {
+  sockaddr_storage ss{};
+  socklen_t slen = 0;
+  int family = AF_INET;
+
+  auto* a4 = (sockaddr_in*)&ss;
+  auto* a6 = (sockaddr_in6*)&ss;
+  if (::inet_pton(AF_INET, lc.address.c_str(), &a4->sin_addr) == 1) {
+    a4->sin_family = AF_INET;
+    a4->sin_port = htons(lc.port);
+    slen = sizeof(sockaddr_in);
+  } else if (::inet_pton(AF_INET6, lc.address.c_str(), &a6->sin6_addr) == 1) {
+    family = AF_INET6;
+    a6->sin6_family = AF_INET6;
+    a6->sin6_port = htons(lc.port);
+    slen = sizeof(sockaddr_in6);
+  } else {
+    err = "invalid address: " + lc.address;
+    return false;
+  }
+
+  int fd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return fail(fd, err, "socket()");
+
+  if (!set_int_opt(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR", err)) { close_quiet(fd); return false; }
+  if (family == AF_INET6 &&
+      !set_int_opt(fd, IPPROTO_IPV6, IPV6_V6ONLY, lc.ipv6_only ? 1 : 0, "IPV6_V6ONLY", err)) {
+    close_quiet(fd);
+    return false;
+  }
+
+  // Buffer sizes must be set before listen() so the window scale offered in
+  // the SYN-ACK matches them; accepted sockets inherit these options.
+  if (lc.rcvbuf && !set_int_opt(fd, SOL_SOCKET, SO_RCVBUF, (int)lc.rcvbuf, "SO_RCVBUF", err)) { close_quiet(fd); return false; }
+  if (lc.sndbuf && !set_int_opt(fd, SOL_SOCKET, SO_SNDBUF, (int)lc.sndbuf, "SO_SNDBUF", err)) { close_quiet(fd); return false; }
+  if (lc.tcp_nodelay && !set_int_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY", err)) { close_quiet(fd); return false; }
+  if (lc.tcp_defer_accept_sec &&
+      !set_int_opt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (int)lc.tcp_defer_accept_sec, "TCP_DEFER_ACCEPT", err)) {
+    close_quiet(fd);
+    return false;
+  }
+  if (lc.tcp_fastopen_qlen &&
+      !set_int_opt(fd, IPPROTO_TCP, TCP_FASTOPEN, (int)lc.tcp_fastopen_qlen, "TCP_FASTOPEN", err)) {
+    close_quiet(fd);
+    return false;
+  }
+
+  if (::bind(fd, (sockaddr*)&ss, slen) < 0) return fail(fd, err, "bind()");
+  if (::listen(fd, (int)lc.backlog) < 0) return fail(fd, err, "listen()");
+
+  out_fd = fd;
+  return true;
+}
+
+static bool open_unix(const ListenerConfig& lc, int& out_fd, std::string& err) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (lc.path.size() >= sizeof(addr.sun_path)) {
+    err = "unix socket path too long: " + lc.path;
+    return false;
+  }
+  std::memcpy(addr.sun_path, lc.path.c_str(), lc.path.size() + 1);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return fail(fd, err, "socket()");
+
+  if (lc.rcvbuf && !set_int_opt(fd, SOL_SOCKET, SO_RCVBUF, (int)lc.rcvbuf, "SO_RCVBUF", err)) { close_quiet(fd); return false; }
+  if (lc.sndbuf && !set_int_opt(fd, SOL_SOCKET, SO_SNDBUF, (int)lc.sndbuf, "SO_SNDBUF", err)) { close_quiet(fd); return false; }
+
+  // Remove a stale socket left by a previous run, but never a regular file.
+  struct stat st{};
+  if (::lstat(lc.path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      err = "refusing to replace non-socket file: " + lc.path;
+      close_quiet(fd);
+      return false;
+    }
+    ::unlink(lc.path.c_str());
+  }
+
+  if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) return fail(fd, err, "bind()");
+  if (::listen(fd, (int)lc.backlog) < 0) return fail(fd, err, "listen()");
+
+  out_fd = fd;
+  return true;
+}
+
+bool open_listener(const ListenerConfig& lc, Listener& out, std::string& err) {
+  out.cfg = lc;
+  out.name = listener_name(lc);
+  out.fd = -1;
+
+  if (lc.kind == ListenerConfig::Kind::UNIX) return open_unix(lc, out.fd, err);
+  return open_tcp(lc, out.fd, err);
+}
+
+bool adopt_listener(const ListenerConfig& lc, int fd, Listener& out, std::string& err) {
+  out.cfg = lc;
+  out.name = listener_name(lc);
+  out.fd = -1;
+
+  if (!set_nonblocking(fd)) return fail(fd, err, "fcntl(O_NONBLOCK)");
+  if (::listen(fd, (int)lc.backlog) < 0) return fail(fd, err, "listen()");
+
+  out.fd = fd;
+  return true;
+}
+
+void close_listener(Listener& l) {
+  close_quiet(l.fd);
+  l.fd = -1;
+}
+
+static std::string format_peer(const sockaddr_storage& ss) {
+  char buf[INET6_ADDRSTRLEN] = {0};
+  if (ss.ss_family == AF_INET) {
+    auto* a = (const sockaddr_in*)&ss;
+    ::inet_ntop(AF_INET, &a->sin_addr, buf, sizeof(buf));
+    return std::string(buf) + ":" + std::to_string(ntohs(a->sin_port));
+  }
+  if (ss.ss_family == AF_INET6) {
+    auto* a = (const sockaddr_in6*)&ss;
+    ::inet_ntop(AF_INET6, &a->sin6_addr, buf, sizeof(buf));
+    std::string out;
+    out.reserve(sizeof(buf) + 8);
+    out.append("[").append(buf).append("]:").append(std::to_string(ntohs(a->sin6_port)));
+    return out;
+  }
+  return "unix";
+}
+
+int accept_connection(const Listener& l, std::string& peer) {
+  sockaddr_storage ss{};
+  socklen_t slen = sizeof(ss);
+
+  int fd;
+  do {
+    fd = ::accept4(l.fd, (sockaddr*)&ss, &slen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) return -1;
+
+  if (l.cfg.kind == ListenerConfig::Kind::TCP && l.cfg.tcp_nodelay) {
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  peer = format_peer(ss);
+  return fd;
+}
+
+}
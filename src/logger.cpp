@@ -56,6 +56,8 @@ void Logger::configure(const std::string& file_path, LogLevel level) {
   std::lock_guard<std::mutex> lk(mu_);
   level_ = level;
 
+  if (file_.is_open()) file_.close();
+  file_.clear();
   file_.open(file_path, std::ios::app);
   if (!file_) {
     std::cerr << "Warning, could not open log file: " << file_path << "\n";
@@ -0,0 +1,198 @@
+#include "memory_budget.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+namespace minihttpd {
+
+namespace {
+
+constexpr size_t kCategoryCount = (size_t)MemCategory::Count;
+constexpr const char* kCategoryNames[kCategoryCount] = {
+  "connections", "request_bodies", "responses", "proxy", "dir_listings",
+};
+
+struct Counter {
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> peak{0};
+};
+
+Counter g_total;
+Counter g_categories[kCategoryCount];
+std::atomic<uint64_t> g_budget{0};
+
+std::atomic<uint64_t> g_paused{0};
+std::atomic<uint64_t> g_refused_requests{0};
+std::atomic<uint64_t> g_rejected_connections{0};
+std::atomic<uint64_t> g_shrink_runs{0};
+std::atomic<uint64_t> g_shrunk_bytes{0};
+
+std::mutex g_shrink_mu;
+std::vector<MemShrinker> g_shrinkers;
+
+// Requests waiting in mem_wait_for_room. Waiters hold g_wait_mu only around
+// atomics and the wait itself, so mem_release may take it under any lock.
+std::mutex g_wait_mu;
+std::condition_variable g_wait_cv;
+std::atomic<uint32_t> g_waiters{0};
+
+}
+
+static void add(Counter& c, uint64_t bytes) {
+  uint64_t now = c.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  uint64_t peak = c.peak.load(std::memory_order_relaxed);
+  while (now > peak && !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+}
+
+void configure_memory_budget(const ServerConfig& cfg) {
+  g_budget.store(cfg.memory_budget_bytes);
+}
+
+void add_memory_shrinker(MemShrinker fn) {
+  std::lock_guard<std::mutex> lk(g_shrink_mu);
+  g_shrinkers.push_back(fn);
+}
+
+void mem_charge(MemCategory c, uint64_t bytes) {
+  add(g_categories[(size_t)c], bytes);
+  add(g_total, bytes);
+}
+
+bool mem_try_charge(MemCategory c, uint64_t bytes) {
+  uint64_t budget = g_budget.load(std::memory_order_relaxed);
+  if (budget == 0) {
+    mem_charge(c, bytes);
+    return true;
+  }
+
+  uint64_t cur = g_total.bytes.load(std::memory_order_relaxed);
+  do {
+    if (cur + bytes > budget) return false;
+  } while (!g_total.bytes.compare_exchange_weak(cur, cur + bytes, std::memory_order_relaxed));
+
+  uint64_t peak = g_total.peak.load(std::memory_order_relaxed);
+  while (cur + bytes > peak && !g_total.peak.compare_exchange_weak(peak, cur + bytes, std::memory_order_relaxed)) {}
+  add(g_categories[(size_t)c], bytes);
+  return true;
+}
+
+void mem_release(MemCategory c, uint64_t bytes) {
+  g_categories[(size_t)c].bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  g_total.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+
+  if (g_waiters.load() > 0) {
+    std::lock_guard<std::mutex> lk(g_wait_mu);
+    g_wait_cv.notify_all();
+  }
+}
+
+bool mem_pressure() {
+  uint64_t budget = g_budget.load(std::memory_order_relaxed);
+  return budget > 0 && g_total.bytes.load(std::memory_order_relaxed) >= budget / 10 * 9;
+}
+
+bool mem_exhausted() {
+  uint64_t budget = g_budget.load(std::memory_order_relaxed);
+  return budget > 0 && g_total.bytes.load(std::memory_order_relaxed) >= budget;
+}
+
+void mem_relieve() {
+  if (!mem_pressure()) return;
+
+  // One thread shrinks at a time; the others would only find empty caches.
+  std::unique_lock<std::mutex> lk(g_shrink_mu, std::try_to_lock);
+  if (!lk.owns_lock()) return;
+
+  // Aim for 80% so the next few charges do not trigger another round.
+  uint64_t target = g_budget.load() / 10 * 8;
+  uint64_t used = g_total.bytes.load();
+  if (used <= target) return;
+  uint64_t want = used - target;
+
+  uint64_t freed = 0;
+  for (MemShrinker fn : g_shrinkers) {
+    if (freed >= want) break;
+    freed += fn(want - freed);
+  }
+  g_shrink_runs.fetch_add(1);
+  g_shrunk_bytes.fetch_add(freed);
+}
+
+bool mem_reserve(MemCharge& c, uint64_t bytes) {
+  if (c.try_resize(bytes)) return true;
+  mem_relieve();
+  return c.try_resize(bytes);
+}
+
+bool mem_wait_for_room(MemCharge& c, uint64_t bytes, int timeout_ms) {
+  if (mem_reserve(c, bytes)) return true;
+
+  g_paused.fetch_add(1);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  for (;;) {
+    {
+      // Registered before the retry, so a release in between notifies under
+      // the lock we hold and cannot be missed. The retry only grows the
+      // charge, which never calls back into mem_release.
+      std::unique_lock<std::mutex> lk(g_wait_mu);
+      g_waiters.fetch_add(1);
+      bool ok = c.try_resize(bytes);
+      auto now = std::chrono::steady_clock::now();
+      // Woken by mem_release; the periodic wake-up retries the shrinkers,
+      // which release cache memory nobody would otherwise signal.
+      if (!ok && now < deadline) g_wait_cv.wait_until(lk, std::min(deadline, now + std::chrono::milliseconds(100)));
+      g_waiters.fetch_sub(1);
+      if (ok) return true;
+      if (now >= deadline) break;
+    }
+    mem_relieve();
+  }
+  g_refused_requests.fetch_add(1);
+  return false;
+}
+
+void mem_note_rejected() {
+  g_rejected_connections.fetch_add(1);
+}
+
+static uint64_t rss_bytes() {
+  FILE* f = std::fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  unsigned long long size = 0, resident = 0;
+  int n = std::fscanf(f, "%llu %llu", &size, &resident);
+  std::fclose(f);
+  return n == 2 ? resident * (uint64_t)::sysconf(_SC_PAGESIZE) : 0;
+}
+
+std::string mem_stats_json() {
+  nlohmann::json j;
+  j["budget_bytes"] = g_budget.load();
+  j["used_bytes"] = g_total.bytes.load();
+  j["peak_bytes"] = g_total.peak.load();
+  j["state"] = mem_exhausted() ? "exhausted" : mem_pressure() ? "pressure" : "ok";
+  j["rss_bytes"] = rss_bytes();
+
+  nlohmann::json cats = nlohmann::json::object();
+  for (size_t i = 0; i < kCategoryCount; i++) {
+    cats[kCategoryNames[i]] = {{"bytes", g_categories[i].bytes.load()}, {"peak_bytes", g_categories[i].peak.load()}};
+  }
+  j["categories"] = cats;
+
+  j["paused_requests"] = g_paused.load();
+  j["refused_requests"] = g_refused_requests.load();
+  j["rejected_connections"] = g_rejected_connections.load();
+  j["cache_shrinks"] = g_shrink_runs.load();
+  j["cache_shrunk_bytes"] = g_shrunk_bytes.load();
+  return j.dump();
+}
+
+}
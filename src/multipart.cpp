@@ -0,0 +1,215 @@
+#include "multipart.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+
+namespace minihttpd {
+
+// Splits `type; a=b; c="d;e"` into the leading token and lower-cased params.
+static std::string parse_params(const std::string& v, std::unordered_map<std::string, std::string>& params) {
+  std::vector<std::string> items;
+  std::string cur;
+  bool quoted = false;
+  for (size_t i = 0; i < v.size(); i++) {
+    char c = v[i];
+    if (quoted && c == '\\' && i + 1 < v.size()) { cur.push_back(c); cur.push_back(v[++i]); continue; }
+    if (c == '"') quoted = !quoted;
+    if (c == ';' && !quoted) { items.push_back(cur); cur.clear(); continue; }
+    cur.push_back(c);
+  }
+  items.push_back(cur);
+
+  for (size_t i = 1; i < items.size(); i++) {
+    auto eq = items[i].find('=');
+    if (eq == std::string::npos) continue;
+    std::string key = to_lower(trim(items[i].substr(0, eq)));
+    std::string val = trim(items[i].substr(eq + 1));
+    if (val.size() >= 2 && val.front() == '"' && val.back() == '"') {
+      std::string unq;
+      for (size_t k = 1; k + 1 < val.size(); k++) {
+        if (val[k] == '\\' && k + 2 < val.size()) k++;
+        unq.push_back(val[k]);
+      }
+      val = std::move(unq);
+    }
+    params[key] = val;
+  }
+  return to_lower(trim(items[0]));
+}
+
+bool multipart_boundary(const std::string& content_type, std::string& out) {
+  std::unordered_map<std::string, std::string> params;
+  if (parse_params(content_type, params) != "multipart/form-data") return false;
+
+  auto it = params.find("boundary");
+  if (it == params.end() || it->second.empty() || it->second.size() > 70) return false;
+  out = it->second;
+  return true;
+}
+
+MultipartParser::MultipartParser(const std::string& boundary, Callbacks cb, size_t max_part_header_bytes)
+  : delim_("\r\n--" + boundary), cb_(std::move(cb)), max_header_bytes_(max_part_header_bytes) {
+  const size_t m = delim_.size();
+  for (auto& s : skip_) s = m;
+  for (size_t k = 0; k + 1 < m; k++) skip_[(unsigned char)delim_[k]] = m - 1 - k;
+
+  // The first delimiter may start the body without a preceding CRLF.
+  buf_ = "\r\n";
+}
+
+size_t MultipartParser::find_delim(size_t from) const {
+  const size_t m = delim_.size();
+  const size_t n = buf_.size();
+  const char* h = buf_.data();
+  const char* p = delim_.data();
+  const unsigned char last = (unsigned char)p[m - 1];
+
+  size_t i = from;
+  while (i + m <= n) {
+    unsigned char c = (unsigned char)h[i + m - 1];
+    if (c == last && std::memcmp(h + i, p, m - 1) == 0) return i;
+    i += skip_[c];
+  }
+  return std::string::npos;
+}
+
+bool MultipartParser::fail(const std::string& e) {
+  err_ = e;
+  state_ = State::FAILED;
+  return false;
+}
+
+bool MultipartParser::parse_part_headers(const std::string& blob, MultipartPart& part) {
+  size_t pos = 0;
+  while (pos < blob.size()) {
+    size_t e = blob.find("\r\n", pos);
+    if (e == std::string::npos) e = blob.size();
+    std::string ln = blob.substr(pos, e - pos);
+    pos = e + 2;
+    if (ln.empty()) continue;
+
+    auto c = ln.find(':');
+    if (c == std::string::npos) return false;
+    part.headers[to_lower(trim(ln.substr(0, c)))] = trim(ln.substr(c + 1));
+  }
+
+  auto it = part.headers.find("content-disposition");
+  if (it == part.headers.end()) return false;
+
+  std::unordered_map<std::string, std::string> params;
+  if (parse_params(it->second, params) != "form-data") return false;
+
+  part.name = params["name"];
+  auto fn = params.find("filename");
+  if (fn != params.end()) {
+    part.filename = fn->second;
+    part.has_filename = true;
+  }
+  return true;
+}
+
+bool MultipartParser::feed(const char* data, size_t len) {
+  if (state_ == State::FAILED) return false;
+  if (state_ == State::DONE) return true;
+
+  buf_.append(data, len);
+
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    const size_t avail = buf_.size() - pos_;
+
+    switch (state_) {
+      case State::PREAMBLE: {
+        size_t idx = find_delim(pos_);
+        if (idx == std::string::npos) {
+          if (avail >= delim_.size()) pos_ = buf_.size() - (delim_.size() - 1);
+          break;
+        }
+        pos_ = idx + delim_.size();
+        state_ = State::AFTER_DELIM;
+        progress = true;
+        break;
+      }
+
+      case State::AFTER_DELIM: {
+        if (avail < 2) break;
+        if (buf_.compare(pos_, 2, "--") == 0) {
+          state_ = State::DONE;
+          buf_.clear();
+          pos_ = 0;
+          return true;
+        }
+        size_t e = buf_.find("\r\n", pos_);
+        if (e == std::string::npos) {
+          if (avail > 256) return fail("malformed boundary line");
+          break;
+        }
+        for (size_t i = pos_; i < e; i++) {
+          if (buf_[i] != ' ' && buf_[i] != '\t') return fail("malformed boundary line");
+        }
+        pos_ = e + 2;
+        state_ = State::HEADERS;
+        progress = true;
+        break;
+      }
+
+      case State::HEADERS: {
+        size_t hdr_end;
+        if (buf_.compare(pos_, 2, "\r\n") == 0) {
+          hdr_end = pos_;
+        } else {
+          size_t e = buf_.find("\r\n\r\n", pos_);
+          if (e == std::string::npos) {
+            if (avail > max_header_bytes_) return fail("part headers too large");
+            break;
+          }
+          hdr_end = e + 2;
+        }
+        if (hdr_end - pos_ > max_header_bytes_) return fail("part headers too large");
+
+        MultipartPart part;
+        if (!parse_part_headers(buf_.substr(pos_, hdr_end - pos_), part)) {
+          return fail("malformed part headers");
+        }
+        pos_ = hdr_end + 2;
+        state_ = State::BODY;
+        if (cb_.on_part_begin && !cb_.on_part_begin(part)) return fail("part rejected");
+        progress = true;
+        break;
+      }
+
+      case State::BODY: {
+        size_t idx = find_delim(pos_);
+        if (idx == std::string::npos) {
+          // Hold back a possible delimiter prefix split across chunks.
+          size_t keep = delim_.size() - 1;
+          if (avail > keep) {
+            size_t n = avail - keep;
+            if (cb_.on_part_data && !cb_.on_part_data(buf_.data() + pos_, n)) return fail("part data rejected");
+            pos_ += n;
+          }
+          break;
+        }
+        if (idx > pos_ && cb_.on_part_data && !cb_.on_part_data(buf_.data() + pos_, idx - pos_)) {
+          return fail("part data rejected");
+        }
+        if (cb_.on_part_end && !cb_.on_part_end()) return fail("part rejected");
+        pos_ = idx + delim_.size();
+        state_ = State::AFTER_DELIM;
+        progress = true;
+        break;
+      }
+
+      case State::DONE:
+      case State::FAILED:
+        break;
+    }
+  }
+
+  buf_.erase(0, pos_);
+  pos_ = 0;
+  return true;
+}
+
+}
@@ -0,0 +1,105 @@
+#include "net.hpp"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+void close_quiet(int fd) {
+  if (fd >= 0) ::close(fd);
+}
+
+bool set_nonblocking(int fd) {
+  int fl = ::fcntl(fd, F_GETFL, 0);
+  if (fl < 0) return false;
+  if (fl & O_NONBLOCK) return true;
+  return ::fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+
+int wait_fd(int fd, short events, int timeout_ms) {
+  pollfd p{};
+  p.fd = fd;
+  p.events = events;
+  while (true) {
+    int r = ::poll(&p, 1, timeout_ms);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) return -1;
+    if (r == 0) return 0;
+    return 1;
+  }
+}
+
+ssize_t recv_some(int fd, void* buf, size_t len, int timeout_ms) {
+  while (true) {
+    ssize_t n = ::recv(fd, buf, len, 0);
+    if (n >= 0) return n;
+    if (errno == EINTR) continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    int w = wait_fd(fd, POLLIN, timeout_ms);
+    if (w < 0) return -1;
+    if (w == 0) { errno = ETIMEDOUT; return -1; }
+  }
+}
+
+bool send_all(int fd, const void* data, size_t len, int timeout_ms) {
+  const char* p = (const char*)data;
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, p + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+      int w = wait_fd(fd, POLLOUT, timeout_ms);
+      if (w < 0) return false;
+      if (w == 0) { errno = ETIMEDOUT; return false; }
+      continue;
+    }
+    if (n == 0) return false;
+    sent += (size_t)n;
+  }
+  return true;
+}
+
+bool send_file_all(int sock_fd, int file_fd, uint64_t offset, uint64_t len, int timeout_ms) {
+  off_t off = (off_t)offset;
+  while (len > 0) {
+    size_t want = (len > (1u << 30)) ? (1u << 30) : (size_t)len;
+    ssize_t n = ::sendfile(sock_fd, file_fd, &off, want);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+      int w = wait_fd(sock_fd, POLLOUT, timeout_ms);
+      if (w < 0) return false;
+      if (w == 0) { errno = ETIMEDOUT; return false; }
+      continue;
+    }
+    if (n == 0) return false;
+    len -= (uint64_t)n;
+  }
+  return true;
+}
+
+bool write_all(int fd, const void* data, size_t len) {
+  const char* p = (const char*)data;
+  while (len > 0) {
+    ssize_t n = ::write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,597 @@
+#include "proxy.hpp"
+#include "logger.hpp"
+#include "memory_budget.hpp"
+#include "net.hpp"
+#include "response.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+using steady = std::chrono::steady_clock;
+
+namespace {
+
+// Connections from one route to one upstream. A reload keeps the pool (and
+// its idle connections) if the route still lists the upstream.
+struct UpstreamPool {
+  UpstreamConfig cfg;
+  std::string name;
+
+  std::mutex mu;
+  std::vector<int> idle;
+  std::string check_path;
+
+  std::atomic<uint32_t> max_idle{16};
+  std::atomic<uint32_t> connect_timeout_ms{1000};
+  std::atomic<uint32_t> check_interval_ms{0};
+
+  std::atomic<uint32_t> outstanding{0};
+  std::atomic<bool> healthy{true};
+  // Dropped from the config; requests still using it close their sockets.
+  std::atomic<bool> retired{false};
+  steady::time_point next_check{};
+
+  ~UpstreamPool() {
+    for (int fd : idle) close_quiet(fd);
+  }
+};
+
+using PoolPtr = std::shared_ptr<UpstreamPool>;
+
+// Pools per route prefix, in upstreams order. Replaced as a whole on reload,
+// so requests only load a pointer.
+struct PoolTable {
+  std::unordered_map<std::string, std::vector<PoolPtr>> routes;
+};
+
+std::atomic<std::shared_ptr<const PoolTable>> g_pool_table{std::make_shared<const PoolTable>()};
+std::mutex g_configure_mu;
+std::once_flag g_health_thread_once;
+std::atomic<uint32_t> g_rr{0};
+
+}
+
+static std::string upstream_name(const UpstreamConfig& u) {
+  if (!u.path.empty()) return "unix:" + u.path;
+  return u.host + ":" + std::to_string(u.port);
+}
+
+static int connect_upstream(const UpstreamConfig& u, int timeout_ms, std::string& err) {
+  std::vector<std::pair<sockaddr_storage, socklen_t>> addrs;
+
+  if (!u.path.empty()) {
+    sockaddr_storage ss{};
+    auto* a = (sockaddr_un*)&ss;
+    a->sun_family = AF_UNIX;
+    std::memcpy(a->sun_path, u.path.c_str(), u.path.size() + 1);
+    addrs.emplace_back(ss, (socklen_t)sizeof(sockaddr_un));
+  } else {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    addrinfo* res = nullptr;
+    int rc = ::getaddrinfo(u.host.c_str(), std::to_string(u.port).c_str(), &hints, &res);
+    if (rc != 0) {
+      err = std::string("getaddrinfo: ") + ::gai_strerror(rc);
+      return -1;
+    }
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+      sockaddr_storage ss{};
+      std::memcpy(&ss, ai->ai_addr, ai->ai_addrlen);
+      addrs.emplace_back(ss, ai->ai_addrlen);
+    }
+    ::freeaddrinfo(res);
+  }
+
+  err = "no address";
+  for (auto& [ss, len] : addrs) {
+    int fd = ::socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { err = std::strerror(errno); continue; }
+
+    int rc = ::connect(fd, (sockaddr*)&ss, len);
+    if (rc < 0 && (errno == EINPROGRESS || errno == EAGAIN)) {
+      int w = wait_fd(fd, POLLOUT, timeout_ms);
+      int soerr = 0;
+      socklen_t sl = sizeof(soerr);
+      if (w <= 0) {
+        soerr = (w == 0) ? ETIMEDOUT : errno;
+      } else {
+        ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &sl);
+      }
+      rc = soerr ? -1 : 0;
+      errno = soerr;
+    }
+    if (rc < 0) {
+      err = std::strerror(errno);
+      close_quiet(fd);
+      continue;
+    }
+
+    if (ss.ss_family != AF_UNIX) {
+      int one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+  }
+  return -1;
+}
+
+static bool probe_upstream(UpstreamPool& p) {
+  std::string err;
+  int timeout = (int)p.connect_timeout_ms.load();
+  int fd = connect_upstream(p.cfg, timeout, err);
+  if (fd < 0) return false;
+
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lk(p.mu);
+    path = p.check_path;
+  }
+  if (path.empty()) {
+    close_quiet(fd);
+    return true;
+  }
+
+  std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + p.name + "\r\nConnection: close\r\n\r\n";
+  bool ok = send_all(fd, req.data(), req.size(), timeout);
+
+  std::string line;
+  char buf[256];
+  while (ok && line.find("\r\n") == std::string::npos && line.size() < 1024) {
+    ssize_t n = recv_some(fd, buf, sizeof(buf), timeout);
+    if (n <= 0) { ok = false; break; }
+    line.append(buf, (size_t)n);
+  }
+  close_quiet(fd);
+
+  // "HTTP/1.x 2xx" or "3xx"
+  return ok && line.size() > 12 && line.compare(0, 5, "HTTP/") == 0 && (line[9] == '2' || line[9] == '3');
+}
+
+static void health_loop() {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Only pools of the current config are checked.
+    std::shared_ptr<const PoolTable> table = g_pool_table.load();
+    auto now = steady::now();
+    for (const auto& kv : table->routes) {
+      for (const PoolPtr& p : kv.second) {
+        uint32_t interval = p->check_interval_ms.load();
+        if (interval == 0 || now < p->next_check) continue;
+        p->next_check = now + std::chrono::milliseconds(interval);
+
+        bool ok = probe_upstream(*p);
+        if (ok != p->healthy.load()) {
+          if (ok) LOG_INFO("Upstream " + p->name + " is healthy again");
+          else LOG_WARN("Upstream " + p->name + " failed its health check");
+          p->healthy.store(ok);
+        }
+      }
+    }
+  }
+}
+
+static void apply_route_settings(const PoolPtr& p, const ProxyRouteConfig& route) {
+  p->max_idle.store(route.pool_size);
+  p->connect_timeout_ms.store(route.connect_timeout_ms);
+  p->check_interval_ms.store(route.health_check_interval_ms);
+  if (route.health_check_interval_ms > 0) {
+    {
+      std::lock_guard<std::mutex> lk(p->mu);
+      p->check_path = route.health_check_path;
+    }
+    std::call_once(g_health_thread_once, [] { std::thread(health_loop).detach(); });
+  } else {
+    p->healthy.store(true);
+  }
+}
+
+// Least outstanding requests among healthy upstreams; ties rotate.
+static PoolPtr pick_pool(const ProxyRouteConfig& route) {
+  std::shared_ptr<const PoolTable> table = g_pool_table.load();
+  auto it = table->routes.find(route.prefix);
+  if (it == table->routes.end() || it->second.empty()) return nullptr;
+  const std::vector<PoolPtr>& pools = it->second;
+
+  size_t n = pools.size();
+  size_t start = g_rr.fetch_add(1) % n;
+
+  PoolPtr best;
+  uint32_t best_load = 0;
+  for (size_t k = 0; k < n; k++) {
+    const PoolPtr& p = pools[(start + k) % n];
+    if (!p->healthy.load()) continue;
+    uint32_t load = p->outstanding.load();
+    if (!best || load < best_load) {
+      best = p;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+static int acquire(UpstreamPool& p, bool& reused, std::string& err) {
+  reused = false;
+  {
+    std::lock_guard<std::mutex> lk(p.mu);
+    while (!p.idle.empty()) {
+      int fd = p.idle.back();
+      p.idle.pop_back();
+      // An idle upstream socket must have nothing to read; EOF or stray
+      // bytes mean the upstream closed or misbehaved.
+      if (wait_fd(fd, POLLIN, 0) != 0) {
+        close_quiet(fd);
+        continue;
+      }
+      reused = true;
+      return fd;
+    }
+  }
+  return connect_upstream(p.cfg, (int)p.connect_timeout_ms.load(), err);
+}
+
+static void release(UpstreamPool& p, int fd, bool reusable) {
+  if (reusable && !p.retired.load()) {
+    std::lock_guard<std::mutex> lk(p.mu);
+    if (p.idle.size() < p.max_idle.load()) {
+      p.idle.push_back(fd);
+      return;
+    }
+  }
+  close_quiet(fd);
+}
+
+static bool is_hop_by_hop(const std::string& lower_name) {
+  return lower_name == "connection" || lower_name == "keep-alive" || lower_name == "proxy-connection" ||
+         lower_name == "te" || lower_name == "trailer" || lower_name == "upgrade" ||
+         lower_name == "transfer-encoding" || lower_name == "expect";
+}
+
+static std::string peer_host(const std::string& peer) {
+  if (peer.empty() || peer == "unix") return {};
+  if (peer[0] == '[') return peer.substr(1, peer.find(']') - 1);
+  return peer.substr(0, peer.rfind(':'));
+}
+
+void configure_proxy(const ServerConfig& cfg) {
+  std::lock_guard<std::mutex> lk(g_configure_mu);
+  std::shared_ptr<const PoolTable> old = g_pool_table.load();
+  auto next = std::make_shared<PoolTable>();
+
+  for (const auto& r : cfg.proxy_routes) {
+    // find_proxy_route picks the first of equal prefixes; so does this.
+    auto [slot, fresh] = next->routes.try_emplace(r.prefix);
+    if (!fresh) continue;
+
+    auto prev = old->routes.find(r.prefix);
+    for (const auto& u : r.upstreams) {
+      std::string name = upstream_name(u);
+      PoolPtr p;
+      if (prev != old->routes.end()) {
+        for (const PoolPtr& q : prev->second) {
+          if (q->name == name) { p = q; break; }
+        }
+      }
+      if (!p) {
+        p = std::make_shared<UpstreamPool>();
+        p->cfg = u;
+        p->name = name;
+      }
+      apply_route_settings(p, r);
+      slot->second.push_back(std::move(p));
+    }
+  }
+
+  // Pools no longer referenced stop being checked and pooled; their idle
+  // sockets close when the last request using them lets go.
+  for (const auto& kv : old->routes) {
+    auto now = next->routes.find(kv.first);
+    for (const PoolPtr& p : kv.second) {
+      bool kept = now != next->routes.end() &&
+                  std::find(now->second.begin(), now->second.end(), p) != now->second.end();
+      if (!kept) p->retired.store(true);
+    }
+  }
+  g_pool_table.store(std::move(next));
+}
+
+// "/api" covers "/api" and "/api/..." but not "/apix".
+static bool route_covers(const std::string& prefix, const std::string& path) {
+  if (path.compare(0, prefix.size(), prefix) != 0) return false;
+  return prefix.back() == '/' || path.size() == prefix.size() || path[prefix.size()] == '/';
+}
+
+const ProxyRouteConfig* find_proxy_route(const ServerConfig& cfg, const std::string& path) {
+  const ProxyRouteConfig* best = nullptr;
+  for (const auto& r : cfg.proxy_routes) {
+    if (!route_covers(r.prefix, path)) continue;
+    if (!best || r.prefix.size() > best->prefix.size()) best = &r;
+  }
+  return best;
+}
+
+// Calls fn(line, lower_name) for each header line of a message head, in
+// the order received.
+template <class Fn>
+static void for_each_header_line(const std::string& blob, Fn&& fn) {
+  size_t pos = blob.find("\r\n");
+  if (pos == std::string::npos) return;
+  pos += 2;
+  while (pos < blob.size()) {
+    size_t e = blob.find("\r\n", pos);
+    if (e == std::string::npos || e == pos) break;
+    std::string ln = blob.substr(pos, e - pos);
+    pos = e + 2;
+
+    auto c = ln.find(':');
+    if (c == std::string::npos) continue;
+    fn(ln, to_lower(trim(ln.substr(0, c))));
+  }
+}
+
+// Upstream header lines minus hop-by-hop fields, in their original order so
+// repeated fields such as Set-Cookie survive. A chunked response's
+// Content-Length, if the upstream sent one anyway, is dropped as well.
+static std::string relay_header_lines(const std::string& blob, bool chunked) {
+  std::string out;
+  for_each_header_line(blob, [&](const std::string& ln, const std::string& name) {
+    if (is_hop_by_hop(name) || (chunked && name == "content-length")) return;
+    out += ln + "\r\n";
+  });
+  return out;
+}
+
+static std::string build_upstream_head(const RequestContext& ctx, const ProxyRouteConfig& route, const std::string& host) {
+  const HttpRequest& req = ctx.req;
+
+  // Routes match the decoded path, so the prefix is cut from that form and
+  // the rest encoded again; otherwise the target goes through untouched.
+  std::string target = req.target;
+  std::string path, query;
+  split_target(req.target, path, query);
+  if (route.strip_prefix && route_covers(route.prefix, path)) {
+    std::string rest = path.substr(route.prefix.size());
+    if (rest.empty() || rest[0] != '/') rest = "/" + rest;
+    target = url_encode(rest);
+    if (req.target.find('?') != std::string::npos) target += "?" + query;
+  }
+
+  std::string head = req.method + " " + target + " HTTP/1.1\r\n";
+  // The client's lines as received, so repeated fields (Cookie) and their
+  // order reach the upstream unchanged.
+  bool has_host = false;
+  std::string xff;
+  for_each_header_line(req.head, [&](const std::string& ln, const std::string& name) {
+    if (is_hop_by_hop(name)) return;
+    if (name == "x-forwarded-for") {
+      std::string v = trim(ln.substr(ln.find(':') + 1));
+      xff = xff.empty() ? v : xff + ", " + v;
+      return;
+    }
+    if (name == "host") has_host = true;
+    head += ln + "\r\n";
+  });
+  if (!has_host) head += "host: " + host + "\r\n";
+
+  std::string client = peer_host(ctx.conn.peer());
+  if (!client.empty()) xff = xff.empty() ? client : xff + ", " + client;
+  if (!xff.empty()) head += "x-forwarded-for: " + xff + "\r\n";
+  head += std::string("x-forwarded-proto: ") + (ctx.conn.is_tls() ? "https" : "http") + "\r\n";
+  head += "connection: keep-alive\r\n\r\n";
+  return head;
+}
+
+void handle_proxy(RequestContext& ctx, const ProxyRouteConfig& route) {
+  const int timeout_ms = (int)std::min<uint64_t>((uint64_t)route.timeout_sec * 1000, 0x7fffffff);
+
+  // One relay buffer for the request body, the response head and body.
+  MemCharge mem(MemCategory::Proxy);
+  if (!reserve_or_503(ctx, mem, ctx.cfg.recv_chunk_size)) return;
+  std::vector<char> buf(ctx.cfg.recv_chunk_size);
+
+  PoolPtr pool;
+  int fd = -1;
+  std::string resp_blob, rest;
+  HttpResponse resp;
+
+  struct Outstanding {
+    PoolPtr p;
+    ~Outstanding() { if (p) p->outstanding.fetch_sub(1); }
+  } outstanding;
+
+  // A pooled connection may have been closed by the upstream while idle. A
+  // request without a body is retried once on a fresh connection; one whose
+  // body has already been streamed cannot be replayed. A refused connect
+  // moves on to the next healthy upstream.
+  const int max_attempts = (int)route.upstreams.size() + 1;
+  bool retried_stale = false;
+  for (int attempt = 0; attempt < max_attempts; attempt++) {
+    pool = pick_pool(route);
+    if (!pool) {
+      send_error(ctx.conn, 503, ctx.reply_keep_alive(), "no healthy upstream");
+      return;
+    }
+    if (outstanding.p) outstanding.p->outstanding.fetch_sub(1);
+    pool->outstanding.fetch_add(1);
+    outstanding.p = pool;
+
+    bool reused = false;
+    std::string err;
+    fd = acquire(*pool, reused, err);
+    if (fd < 0) {
+      LOG_WARN("Upstream " + pool->name + " connect failed: " + err);
+      if (pool->check_interval_ms.load() > 0) pool->healthy.store(false);
+      if (attempt + 1 < max_attempts) continue;
+      send_error(ctx.conn, 502, ctx.reply_keep_alive(), "upstream unavailable");
+      return;
+    }
+    bool can_retry = reused && !retried_stale && ctx.body.content_length() == 0;
+    if (can_retry) retried_stale = true;
+
+    std::string head = build_upstream_head(ctx, route, pool->name);
+    if (!send_all(fd, head.data(), head.size(), timeout_ms)) {
+      close_quiet(fd);
+      fd = -1;
+      if (can_retry) continue;
+      send_error(ctx.conn, 502, ctx.reply_keep_alive(), "upstream write failed");
+      return;
+    }
+
+    while (!ctx.body.done()) {
+      ssize_t n = ctx.body.read(buf.data(), buf.size());
+      if (n < 0) {
+        close_quiet(fd);
+        return;
+      }
+      if (!send_all(fd, buf.data(), (size_t)n, timeout_ms)) {
+        close_quiet(fd);
+        send_error(ctx.conn, 502, false, "upstream write failed");
+        return;
+      }
+    }
+
+    std::string in;
+    bool got_head = false;
+    bool timed_out = false;
+    while (!got_head) {
+      size_t e = in.find("\r\n\r\n");
+      if (e != std::string::npos) {
+        resp_blob = in.substr(0, e + 4);
+        rest = in.substr(e + 4);
+        std::string perr;
+        if (!parse_http_response_headers(resp_blob, resp, perr)) {
+          LOG_WARN("Bad response from " + pool->name + ": " + perr);
+          break;
+        }
+        if (resp.status >= 100 && resp.status < 200) {
+          in = rest;
+          continue;
+        }
+        got_head = true;
+        break;
+      }
+      if (in.size() > ctx.cfg.read_header_max_bytes) break;
+
+      ssize_t n = recv_some(fd, buf.data(), buf.size(), timeout_ms);
+      if (n <= 0) {
+        timed_out = (n < 0 && errno == ETIMEDOUT);
+        break;
+      }
+      in.append(buf.data(), (size_t)n);
+    }
+
+    if (got_head) break;
+
+    close_quiet(fd);
+    fd = -1;
+    if (in.empty() && !timed_out && can_retry) continue;
+    send_error(ctx.conn, timed_out ? 504 : 502, ctx.reply_keep_alive());
+    return;
+  }
+  if (fd < 0) {
+    send_error(ctx.conn, 502, ctx.reply_keep_alive());
+    return;
+  }
+
+  const bool no_body = ctx.req.method == "HEAD" || resp.status == 204 || resp.status == 304;
+  const bool framed = no_body || resp.chunked || resp.has_content_length;
+  auto uc = resp.headers.find("connection");
+  bool upstream_reusable = framed && resp.version == "HTTP/1.1" &&
+                           !(uc != resp.headers.end() && to_lower(uc->second).find("close") != std::string::npos);
+
+  // Transfer-Encoding is hop-by-hop: an HTTP/1.1 client gets the chunks as
+  // they are, an HTTP/1.0 client the bare data delimited by closing.
+  const bool chunked_out = resp.chunked && !no_body && ctx.req.version == "HTTP/1.1";
+  const bool dechunk = resp.chunked && !no_body && !chunked_out;
+  const bool client_ka = ctx.reply_keep_alive() && framed && !dechunk;
+  if (!client_ka) ctx.force_close = true;
+
+  std::string out = "HTTP/1.1 " + std::to_string(resp.status) + " " + resp.reason + "\r\n";
+  out += relay_header_lines(resp_blob, resp.chunked);
+  if (chunked_out) out += "Transfer-Encoding: chunked\r\n";
+  out += client_ka ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+  ChunkedScanner chunks;
+  uint64_t left = resp.content_length;
+  bool complete = no_body || (!resp.chunked && resp.has_content_length && left == 0);
+
+  // How much of [p, p+n) belongs to the response body; bytes past its end
+  // mean the upstream connection is out of sync and must not be reused.
+  // When dechunking, the bare data goes to `data`.
+  std::string data;
+  auto frame = [&](const char* p, size_t n) -> size_t {
+    if (resp.chunked) {
+      size_t take = chunks.feed(p, n, dechunk ? &data : nullptr);
+      complete = chunks.done();
+      return take;
+    }
+    if (resp.has_content_length) {
+      size_t take = (size_t)std::min<uint64_t>(left, n);
+      left -= take;
+      complete = (left == 0);
+      return take;
+    }
+    return n;
+  };
+
+  bool overflow = false;
+  if (no_body) {
+    overflow = !rest.empty();
+  } else if (!rest.empty()) {
+    size_t take = frame(rest.data(), rest.size());
+    overflow = take < rest.size();
+    if (dechunk) out += data;
+    else out.append(rest.data(), take);
+  }
+  ctx.conn.note_status(resp.status);
+  bool ok = !chunks.bad() && ctx.conn.send_string(out);
+
+  while (ok && !complete && !overflow) {
+    ssize_t n = recv_some(fd, buf.data(), buf.size(), timeout_ms);
+    if (n == 0 && !framed) {
+      complete = true;
+      break;
+    }
+    if (n <= 0) {
+      ok = false;
+      break;
+    }
+    data.clear();
+    size_t take = frame(buf.data(), (size_t)n);
+    overflow = take < (size_t)n;
+    if (dechunk) ok = !chunks.bad() && (data.empty() || ctx.conn.send_string(data));
+    else ok = !chunks.bad() && (take == 0 || ctx.conn.send_all(buf.data(), take));
+  }
+
+  if (!ok || !complete) {
+    LOG_WARN("Proxying " + ctx.req.target + " via " + pool->name + " ended early");
+    ctx.force_close = true;
+    close_quiet(fd);
+    return;
+  }
+
+  release(*pool, fd, upstream_reusable && !overflow);
+}
+
+}
@@ -0,0 +1,50 @@
+#include "range_set.hpp"
+
+#include <iterator>
+
+namespace minihttpd {
+
+void RangeSet::add(uint64_t begin, uint64_t end) {
+  if (begin >= end) return;
+
+  auto it = ranges_.upper_bound(begin);
+  if (it != ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second >= begin) {
+      if (prev->second >= end) return;
+      begin = prev->first;
+      covered_ -= prev->second - prev->first;
+      ranges_.erase(prev);
+    }
+  }
+
+  it = ranges_.lower_bound(begin);
+  while (it != ranges_.end() && it->first <= end) {
+    if (it->second > end) end = it->second;
+    covered_ -= it->second - it->first;
+    it = ranges_.erase(it);
+  }
+
+  ranges_.emplace(begin, end);
+  covered_ += end - begin;
+}
+
+bool RangeSet::covers(uint64_t begin, uint64_t end) const {
+  if (begin >= end) return true;
+  auto it = ranges_.upper_bound(begin);
+  if (it == ranges_.begin()) return false;
+  --it;
+  return it->first <= begin && it->second >= end;
+}
+
+bool RangeSet::touches(uint64_t begin, uint64_t end) const {
+  auto it = ranges_.upper_bound(end);
+  if (it == ranges_.begin()) return false;
+  return std::prev(it)->second >= begin;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> RangeSet::ranges() const {
+  return {ranges_.begin(), ranges_.end()};
+}
+
+}
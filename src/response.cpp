@@ -0,0 +1,110 @@
+#include "response.hpp"
+#include "handler.hpp"
+#include "logger.hpp"
+#include "utils.hpp"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace minihttpd {
+
+void set_common_headers(HttpResponseHead& head, bool keep_alive) {
+  head.reason = status_reason(head.status);
+  head.headers["Date"] = http_date_now();
+  head.headers["Server"] = "minihttpd";
+  head.headers["Connection"] = keep_alive ? "keep-alive" : "close";
+}
+
+bool send_head(Connection& conn, HttpResponseHead head, bool keep_alive) {
+  set_common_headers(head, keep_alive);
+  conn.note_status(head.status);
+  return conn.send_string(build_response_head(head));
+}
+
+bool send_response(Connection& conn, HttpResponseHead head, const std::string& body, bool keep_alive) {
+  set_common_headers(head, keep_alive);
+  conn.note_status(head.status);
+  head.headers["Content-Length"] = std::to_string(body.size());
+
+  std::string out = build_response_head(head);
+  if (!conn.head_request()) out += body;
+  return conn.send_string(out);
+}
+
+bool send_stream_head(Connection& conn, HttpResponseHead head, bool chunked, bool keep_alive) {
+  set_common_headers(head, chunked && keep_alive);
+  conn.note_status(head.status);
+  if (chunked) head.headers["Transfer-Encoding"] = "chunked";
+  return conn.send_string(build_response_head(head));
+}
+
+// Chunk sizes may carry leading zeros, so a fixed-width size line is
+// reserved up front and each chunk goes out in one send.
+static constexpr size_t kChunkPrefix = 10;  // 8 hex digits + CRLF
+static constexpr size_t kMaxChunk = 0xFFFFFFFF;
+
+ChunkedWriter::ChunkedWriter(Connection& conn, bool chunked, size_t flush_bytes)
+  : conn_(conn), chunked_(chunked), flush_bytes_(flush_bytes) {
+  // Without room for the batching buffer every write goes out on its own.
+  if (mem_reserve(mem_, kChunkPrefix + flush_bytes_ + 64)) buf_.reserve(mem_.bytes());
+  else flush_bytes_ = 0;
+  if (chunked_) buf_.assign(kChunkPrefix, '0');
+}
+
+bool ChunkedWriter::write(std::string_view s) {
+  // A chunk never outgrows what its size line can state.
+  size_t start = chunked_ ? kChunkPrefix : 0;
+  while (buf_.size() - start + s.size() > kMaxChunk) {
+    size_t n = kMaxChunk - (buf_.size() - start);
+    buf_.append(s.substr(0, n));
+    s.remove_prefix(n);
+    if (!flush()) return false;
+  }
+  buf_.append(s);
+  return buf_.size() < flush_bytes_ || flush();
+}
+
+bool ChunkedWriter::flush() {
+  size_t start = chunked_ ? kChunkPrefix : 0;
+  if (buf_.size() == start) return true;
+
+  if (chunked_) {
+    char size_line[kChunkPrefix + 1];
+    std::snprintf(size_line, sizeof(size_line), "%08x\r\n", (uint32_t)(buf_.size() - kChunkPrefix));
+    buf_.replace(0, kChunkPrefix, size_line, kChunkPrefix);
+    buf_.append("\r\n");
+  }
+  bool ok = conn_.send_string(buf_);
+  buf_.resize(start);
+  return ok;
+}
+
+bool ChunkedWriter::finish() {
+  if (!flush()) return false;
+  return !chunked_ || conn_.send_string("0\r\n\r\n");
+}
+
+bool send_json(Connection& conn, int status, const std::string& json, bool keep_alive) {
+  HttpResponseHead head;
+  head.status = status;
+  head.headers["Content-Type"] = "application/json; charset=utf-8";
+  return send_response(conn, std::move(head), json, keep_alive);
+}
+
+void send_error(Connection& conn, int status, bool keep_alive, const std::string& detail) {
+  HttpResponseHead head;
+  head.status = status;
+  head.headers["Content-Type"] = "text/html; charset=utf-8";
+
+  std::string body = error_page_html(status, status_reason(status), detail);
+  (void)send_response(conn, std::move(head), body, keep_alive);
+}
+
+bool reserve_or_503(RequestContext& ctx, MemCharge& mem, uint64_t bytes) {
+  if (mem_reserve(mem, bytes)) return true;
+  LOG_WARN("Memory budget exhausted, refusing " + ctx.req.method + " " + ctx.req.target + " -> 503");
+  send_error(ctx.conn, 503, ctx.reply_keep_alive(), "server is out of memory budget, retry later");
+  return false;
+}
+
+}
@@ -0,0 +1,232 @@
+#include "router.hpp"
+#include "response.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <vector>
+
+namespace minihttpd {
+
+static constexpr size_t kMethodCount = 7;
+static constexpr const char* kMethodNames[kMethodCount] = {"GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH"};
+
+uint16_t method_bit(std::string_view method) {
+  for (size_t i = 0; i < kMethodCount; i++) {
+    if (method == kMethodNames[i]) return (uint16_t)(1u << i);
+  }
+  return 0;
+}
+
+std::string_view RouteParams::get(std::string_view name) const {
+  for (size_t i = 0; i < count; i++) {
+    if (items[i].first == name) return items[i].second;
+  }
+  return {};
+}
+
+struct Router::Node {
+  std::string literal;
+  std::vector<std::unique_ptr<Node>> literals;
+  std::unique_ptr<Node> param;
+  std::string param_name;
+  std::unique_ptr<Node> wildcard;
+  std::string wildcard_name;
+
+  uint16_t methods = 0;
+  uint16_t reads_body = 0;
+  std::array<RouteHandler, kMethodCount> handlers{};
+};
+
+// Advances pos past the next non-empty, non-"." segment of path.
+static bool next_segment(std::string_view path, size_t& pos, std::string_view& seg) {
+  while (pos < path.size()) {
+    if (path[pos] == '/') {
+      pos++;
+      continue;
+    }
+    size_t end = path.find('/', pos);
+    if (end == std::string_view::npos) end = path.size();
+    seg = path.substr(pos, end - pos);
+    pos = end;
+    if (seg != ".") return true;
+  }
+  return false;
+}
+
+Router::Router() : root_(std::make_unique<Node>()) {}
+Router::~Router() = default;
+
+void Router::add(uint16_t methods, std::string_view pattern, RouteHandler handler, bool reads_body) {
+  const std::string where = "route " + std::string(pattern);
+  if (!handler || methods == 0 || (methods & ~kMethodAny)) throw std::logic_error(where + ": bad methods or handler");
+
+  Node* n = root_.get();
+  size_t nparams = 0;
+  size_t pos = 0;
+  std::string_view seg;
+
+  while (next_segment(pattern, pos, seg)) {
+    if (seg[0] == ':' || seg[0] == '*') {
+      std::string name(seg.substr(1));
+      if (name.empty()) throw std::logic_error(where + ": unnamed capture");
+      if (++nparams > kMaxRouteParams) throw std::logic_error(where + ": too many captures");
+
+      bool wild = seg[0] == '*';
+      std::unique_ptr<Node>& child = wild ? n->wildcard : n->param;
+      std::string& child_name = wild ? n->wildcard_name : n->param_name;
+      if (child && child_name != name) throw std::logic_error(where + ": conflicts with capture " + child_name);
+      if (!child) {
+        child = std::make_unique<Node>();
+        child_name = name;
+      }
+      n = child.get();
+
+      std::string_view more;
+      if (wild && next_segment(pattern, pos, more)) throw std::logic_error(where + ": '*' must be last");
+      continue;
+    }
+
+    auto it = std::find_if(n->literals.begin(), n->literals.end(),
+                           [seg](const std::unique_ptr<Node>& c) { return c->literal == seg; });
+    if (it == n->literals.end()) {
+      n->literals.push_back(std::make_unique<Node>());
+      n->literals.back()->literal = std::string(seg);
+      it = n->literals.end() - 1;
+    }
+    n = it->get();
+  }
+
+  if (n->methods & methods) throw std::logic_error(where + ": registered twice");
+  n->methods |= methods;
+  if (reads_body) n->reads_body |= methods;
+  for (size_t i = 0; i < kMethodCount; i++) {
+    if (methods & (1u << i)) n->handlers[i] = handler;
+  }
+}
+
+static void compile_node(Router::Node* n) {
+  std::sort(n->literals.begin(), n->literals.end(),
+            [](const std::unique_ptr<Router::Node>& a, const std::unique_ptr<Router::Node>& b) {
+              return a->literal < b->literal;
+            });
+  for (auto& c : n->literals) compile_node(c.get());
+  if (n->param) compile_node(n->param.get());
+  if (n->wildcard) compile_node(n->wildcard.get());
+}
+
+void Router::compile() {
+  compile_node(root_.get());
+}
+
+namespace {
+
+// Depth-first in priority order; backtracks only when a path runs out of
+// matching segments, so a typical lookup touches each segment once.
+struct Finder {
+  using Node = Router::Node;
+
+  std::string_view path;
+  RouteParams& params;
+
+  const Node* find(const Node* n, size_t pos) {
+    size_t next = pos;
+    std::string_view seg;
+    if (!next_segment(path, next, seg)) {
+      if (n->methods) return n;
+      if (n->wildcard && n->wildcard->methods) {
+        params.items[params.count++] = {n->wildcard_name, std::string_view{}};
+        return n->wildcard.get();
+      }
+      return nullptr;
+    }
+
+    auto it = std::lower_bound(n->literals.begin(), n->literals.end(), seg,
+                               [](const std::unique_ptr<Node>& c, std::string_view s) { return c->literal < s; });
+    if (it != n->literals.end() && (*it)->literal == seg) {
+      if (const Node* r = find(it->get(), next)) return r;
+    }
+
+    if (n->param) {
+      size_t saved = params.count;
+      params.items[params.count++] = {n->param_name, seg};
+      if (const Node* r = find(n->param.get(), next)) return r;
+      params.count = saved;
+    }
+
+    if (n->wildcard && n->wildcard->methods) {
+      params.items[params.count++] = {n->wildcard_name, path.substr(next - seg.size())};
+      return n->wildcard.get();
+    }
+    return nullptr;
+  }
+};
+
+}
+
+RouteMatch Router::match(std::string_view method, std::string_view path) const {
+  RouteMatch m;
+  uint16_t bit = method_bit(method);
+  if (bit == 0) {
+    m.result = RouteMatch::Result::NotImplemented;
+    return m;
+  }
+
+  Finder f{path, m.params};
+  const Node* n = f.find(root_.get(), 0);
+  if (!n) {
+    m.params.count = 0;
+    m.result = RouteMatch::Result::NotFound;
+    return m;
+  }
+
+  m.allowed = n->methods;
+  if (!(n->methods & bit)) {
+    m.result = RouteMatch::Result::MethodNotAllowed;
+    return m;
+  }
+
+  m.result = RouteMatch::Result::Found;
+  m.handler = n->handlers[(size_t)std::countr_zero(bit)];
+  m.reads_body = (n->reads_body & bit) != 0;
+  return m;
+}
+
+void Router::dispatch(RequestContext& ctx, std::string_view path) const {
+  RouteMatch m = match(ctx.req.method, path);
+
+  if (m.result != RouteMatch::Result::Found || !m.reads_body) {
+    if (!ctx.body.discard(ctx.cfg.recv_chunk_size)) return;
+  }
+
+  switch (m.result) {
+    case RouteMatch::Result::Found:
+      m.handler(ctx, m.params);
+      return;
+    case RouteMatch::Result::NotFound:
+      send_error(ctx.conn, 404, ctx.reply_keep_alive());
+      return;
+    case RouteMatch::Result::NotImplemented:
+      send_error(ctx.conn, 501, ctx.reply_keep_alive());
+      return;
+    case RouteMatch::Result::MethodNotAllowed:
+      break;
+  }
+
+  std::string allow;
+  for (size_t i = 0; i < kMethodCount; i++) {
+    if (!(m.allowed & (1u << i))) continue;
+    if (!allow.empty()) allow += ", ";
+    allow += kMethodNames[i];
+  }
+
+  HttpResponseHead head;
+  head.status = 405;
+  head.headers["Content-Type"] = "text/html; charset=utf-8";
+  head.headers["Allow"] = allow;
+  std::string body = error_page_html(405, status_reason(405), "Allowed: " + allow);
+  send_response(ctx.conn, std::move(head), body, ctx.reply_keep_alive());
+}
+
+}
@@ -0,0 +1,15 @@
+#include "router.hpp"
+#include "storage.hpp"
+#include "upload.hpp"
+#include "upload_session.hpp"
+
+namespace minihttpd {
+
+// Order does not matter: the trie ranks routes by specificity.
+void register_routes(Router& r) {
+  register_upload_session_routes(r);
+  register_upload_routes(r);
+  register_storage_routes(r);
+}
+
+}
@@ -1,59 +1,59 @@
 #include "server.hpp"
 
+#include "access_log.hpp"
+#include "admin.hpp"
+#include "body.hpp"
+#include "connection.hpp"
+#include "dirlist.hpp"
+#include "handler.hpp"
+#include "handoff.hpp"
 #include "http.hpp"
+#include "listener.hpp"
+#include "memory_budget.hpp"
+#include "net.hpp"
+#include "proxy.hpp"
+#include "response.hpp"
+#include "router.hpp"
+#include "tls.hpp"
 #include "utils.hpp"
 #include "logger.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cerrno>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
-#include <sstream>
+#include <memory>
 #include <thread>
 #include <vector>
 
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 namespace minihttpd {
 
 static std::atomic<uint32_t> g_active_clients{0};
+static std::atomic<bool> g_draining{false};
 
-static void close_quiet(int fd) {
-  if (fd >= 0) ::close(fd);
-}
-
-static void set_socket_timeouts(int fd, uint32_t rcv_timeout_sec) {
-  timeval tv{};
-  tv.tv_sec = (int)rcv_timeout_sec;
-  tv.tv_usec = 0;
-  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-}
-
-static bool send_all(int fd, const void* data, size_t len) {
-  const char* p = (const char*)data;
-  size_t sent = 0;
-  while (sent < len) {
-    ssize_t n = ::send(fd, p + sent, len - sent, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue;
-      return false;
-    }
-    if (n == 0) return false;
-    sent += (size_t)n;
-  }
-  return true;
-}
+// Immutable snapshot of the current config. Each request pins the snapshot it
+// started with; SIGHUP swaps in a new one without touching in-flight requests.
+static std::atomic<std::shared_ptr<const ServerConfig>> g_config;
 
-static bool send_string(int fd, const std::string& s) {
-  return send_all(fd, s.data(), s.size());
-}
+// Replaced on reload like the config; live SSL objects keep their own
+// reference to the SSL_CTX they were created from.
+static std::atomic<std::shared_ptr<TlsContext>> g_tls;
 
 static bool wants_keepalive(const HttpRequest& req, const ServerConfig& cfg) {
   if (!cfg.keep_alive) return false;
+  if (g_draining.load()) return false;
 
   auto it = req.headers.find("connection");
   std::string conn = (it != req.headers.end()) ? to_lower(it->second) : "";
@@ -67,228 +67,584 @@ static bool wants_keepalive(const HttpRequest& req, const ServerConfig& cfg) {
   return false;
 }
 
-static void send_error(int fd, int status, bool keep_alive) {
-  HttpResponseHead head;
-  head.status = status;
-  head.reason = status_reason(status);
-
-  std::string body = error_page_html(status, head.reason, "minihttpd could not process your request.");
-
-  head.headers["Date"] = http_date_now();
-  head.headers["Server"] = "minihttpd";
-  head.headers["Content-Type"] = "text/html; charset=utf-8";
-  head.headers["Content-Length"] = std::to_string(body.size());
-  head.headers["Connection"] = keep_alive ? "keep-alive" : "close";
-
-  std::string hdr = build_response_head(head);
-  (void)send_string(fd, hdr);
-  (void)send_string(fd, body);
+// Built once on first use; run() touches it before accepting so a bad
+// registration fails at startup.
+static const Router& router() {
+  static const std::unique_ptr<Router> r = [] {
+    auto built = std::make_unique<Router>();
+    register_routes(*built);
+    built->compile();
+    return built;
+  }();
+  return *r;
 }
 
-static void send_stub_response(int fd, const ServerConfig& cfg, const HttpRequest& req) {
-  bool ka = wants_keepalive(req, cfg);
-
-  int status = (req.method == "GET") ? 200 : 501;
-
-  HttpResponseHead head;
-  head.status = status;
-  head.reason = status_reason(status);
-
-  std::ostringstream body;
-  body << "<!doctype html><html><head><meta charset=\"utf-8\"/>"
-       << "<title>" << head.status << " " << html_escape(head.reason) << "</title>"
-       << "</head><body style=\"font-family:sans-serif;\">"
-       << "<h1>" << head.status << " " << html_escape(head.reason) << "</h1>"
-       << "<p><b>Method:</b> " << html_escape(req.method) << "</p>"
-       << "<p><b>Target:</b> " << html_escape(req.target) << "</p>"
-       << "<p>This is Module 5 (socket core). Routing + storage comes in Module 6.</p>"
-       << "</body></html>";
-
-  std::string body_str = body.str();
-
-  head.headers["Date"] = http_date_now();
-  head.headers["Server"] = "minihttpd";
-  head.headers["Content-Type"] = "text/html; charset=utf-8";
-  head.headers["Content-Length"] = std::to_string(body_str.size());
-  head.headers["Connection"] = ka ? "keep-alive" : "close";
-  if (ka) {
-    head.headers["Keep-Alive"] =
-      "timeout=" + std::to_string(cfg.keep_alive_timeout_sec) +
-      ", max=" + std::to_string(cfg.keep_alive_max_requests);
-  }
-
-  std::string hdr = build_response_head(head);
-  (void)send_string(fd, hdr);
-  (void)send_string(fd, body_str);
+static const Router& admin_router() {
+  static const std::unique_ptr<Router> r = [] {
+    auto built = std::make_unique<Router>();
+    register_admin_routes(*built);
+    built->compile();
+    return built;
+  }();
+  return *r;
 }
 
-static bool drain_body(int fd, const ServerConfig& cfg, uint64_t content_length, std::string& already, std::string& pending_out) {
-  pending_out.clear();
-
-  if (content_length == 0) {
-    pending_out = std::move(already);
-    already.clear();
-    return true;
-  }
-
-  uint64_t have = already.size();
-  uint64_t take = (have > content_length) ? content_length : have;
+static bool is_admin_path(const std::string& path) {
+  size_t n = std::strlen(kAdminPrefix);
+  return path.compare(0, n, kAdminPrefix) == 0 && (path.size() == n || path[n] == '/');
+}
 
-  if (have > take) {
-    pending_out = already.substr((size_t)take);
+// Waits for the next request on an idle keep-alive connection, giving up early
+// once the server starts draining.
+static bool wait_next_request(Connection& conn) {
+  int left = conn.timeout_ms();
+  while (left > 0) {
+    if (g_draining.load()) return false;
+    int slice = left < 250 ? left : 250;
+    int w = conn.wait_readable(slice);
+    if (w != 0) return w > 0;
+    left -= slice;
   }
+  return false;
+}
 
-  uint64_t remaining = content_length - take;
+static std::atomic<uint64_t> g_next_conn_id{1};
 
-  std::vector<char> buf(cfg.recv_chunk_size);
-  while (remaining > 0) {
-    size_t want = (remaining > (uint64_t)buf.size()) ? buf.size() : (size_t)remaining;
-    ssize_t n = ::recv(fd, buf.data(), want, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue;
-      return false;
-    }
-    if (n == 0) return false;
-    remaining -= (uint64_t)n;
-  }
+// OpenSSL's read and write record buffers (max record plus overhead), which
+// it keeps for the life of the connection.
+static constexpr uint64_t kTlsBufferBytes = 2 * (16384 + 2048);
 
-  already.clear();
-  return true;
+// What a connection reserves before reading a request: TLS records, the
+// receive chunk and a full header buffer.
+static uint64_t request_reservation(const ServerConfig& cfg, bool tls) {
+  return (tls ? kTlsBufferBytes : 0) + cfg.recv_chunk_size + cfg.read_header_max_bytes;
 }
 
-static void handle_client(int client_fd, const ServerConfig& cfg) {
-  struct Guard {
-    int fd;
-    ~Guard() { close_quiet(fd); g_active_clients.fetch_sub(1); }
-  } guard{client_fd};
-
-  set_socket_timeouts(client_fd, cfg.keep_alive_timeout_sec);
+// The access-log entry of one request, recorded when it goes out of scope so
+// that replies sent on early error paths are logged too. Status and bytes_out
+// are taken from the connection at that point.
+struct RequestLogEntry {
+  explicit RequestLogEntry(Connection& c) : conn(c), sent_before(c.bytes_sent()) {}
+
+  Connection& conn;
+  uint64_t sent_before;
+  AccessRecord rec{};
+  std::string method, target;
+
+  ~RequestLogEntry() {
+    if (conn.status() == 0 && rec.headers_ns == 0) return;  // nothing to log
+    rec.flushed_ns = mono_ns();
+    rec.bytes_out = conn.bytes_sent() - sent_before;
+    rec.status = (uint16_t)conn.status();
+    if (conn.is_tls()) rec.flags |= kAccessTls;
+    AccessLog::instance().record(rec, method, conn.peer(), target);
+  }
+};
 
+// The request loop of one connection; returns when it should be closed.
+static void serve_requests(Connection& conn, bool admin, uint64_t conn_id, uint64_t accept_ns, MemCharge& buf_mem) {
   uint32_t handled = 0;
   std::string pending;
+  const uint64_t base = conn.is_tls() ? kTlsBufferBytes : 0;
 
   while (true) {
+    std::shared_ptr<const ServerConfig> snap = g_config.load();
+    const ServerConfig& cfg = *snap;
+    conn.set_timeout_sec(cfg.keep_alive_timeout_sec);
+
     if (cfg.keep_alive && handled >= cfg.keep_alive_max_requests) {
       LOG_DEBUG("keep-alive max requests reached, closing");
       break;
     }
 
+    if (pending.empty() && !wait_next_request(conn)) break;
+
+    conn.reset_status();
+    conn.set_head_request(false);
+    RequestLogEntry entry(conn);
+    entry.rec.accept_ns = handled == 0 ? accept_ns : 0;
+    entry.rec.conn_id = conn_id;
+    entry.rec.seq = (uint16_t)(handled + 1);
+
+    // Backpressure: leave the request in the socket buffer until in-flight
+    // requests have released enough memory to reserve its buffers.
+    const uint64_t wait_ns = mono_ns();
+    if (!mem_wait_for_room(buf_mem, std::max<uint64_t>(buf_mem.bytes(), request_reservation(cfg, conn.is_tls())),
+                           conn.timeout_ms())) {
+      LOG_WARN("Memory budget exhausted, refusing request -> 503");
+      entry.rec.first_byte_ns = wait_ns;
+      send_error(conn, 503, false, "server is out of memory budget, retry later");
+      break;
+    }
+
+    // Pipelined bytes count as arriving now; otherwise at the first recv.
+    uint64_t& first_byte_ns = entry.rec.first_byte_ns;
+    first_byte_ns = pending.empty() ? 0 : mono_ns();
+
     std::string buf = pending;
     pending.clear();
 
     std::vector<char> tmp(cfg.recv_chunk_size);
+    // Growth past the reservation is reserved before the string reallocates.
+    auto reserve_buf = [&](size_t want) {
+      if (want <= buf.capacity()) return true;
+      size_t cap = std::max(want, buf.capacity() * 2);
+      if (!buf_mem.try_resize(std::max<uint64_t>(buf_mem.bytes(), base + tmp.size() + buf.capacity() + cap))) {
+        return false;
+      }
+      buf.reserve(cap);
+      return true;
+    };
     size_t header_end = std::string::npos;
 
     while (header_end == std::string::npos) {
       header_end = buf.find("\r\n\r\n");
       if (header_end != std::string::npos) { header_end += 4; break; }
 
-      ssize_t n = ::recv(client_fd, tmp.data(), tmp.size(), 0);
-      if (n < 0) {
-        if (errno == EINTR) continue;
+      if (buf.size() > cfg.read_header_max_bytes) {
+        LOG_WARN("Header too large -> 400");
+        entry.rec.bytes_in = buf.size();
+        send_error(conn, 400, false);
         return;
       }
-      if (n == 0) return;
-      buf.append(tmp.data(), (size_t)n);
 
-      if (buf.size() > cfg.read_header_max_bytes) {
-        LOG_WARN("Header too large -> 400");
-        send_error(client_fd, 400, false);
+      ssize_t n = conn.recv_some(tmp.data(), tmp.size());
+      if (n <= 0) return;
+      if (first_byte_ns == 0) first_byte_ns = mono_ns();
+      if (!reserve_buf(buf.size() + (size_t)n)) {
+        LOG_WARN("Memory budget exhausted while reading headers -> 503");
+        entry.rec.bytes_in = buf.size() + (size_t)n;
+        send_error(conn, 503, false, "server is out of memory budget, retry later");
         return;
       }
+      buf.append(tmp.data(), (size_t)n);
     }
 
+    entry.rec.bytes_in = header_end;
+    if (header_end > cfg.read_header_max_bytes) {
+      LOG_WARN("Header too large -> 400");
+      send_error(conn, 400, false);
+      return;
+    }
+
+    // The split copies at most buf.size() bytes; reserve them before.
+    if (!buf_mem.try_resize(std::max<uint64_t>(buf_mem.bytes(), base + tmp.size() + buf.capacity() + buf.size() + 64))) {
+      LOG_WARN("Memory budget exhausted while reading headers -> 503");
+      send_error(conn, 503, false, "server is out of memory budget, retry later");
+      return;
+    }
     std::string header_blob = buf.substr(0, header_end);
-    std::string after = buf.substr(header_end); 
+    std::string after = buf.substr(header_end);
+    buf = std::string();
+    tmp = std::vector<char>();
+    buf_mem.resize(base + header_blob.capacity() + after.capacity());
     HttpRequest req;
     std::string perr;
-    if (!parse_http_request_headers(header_blob, req, perr)) {
+    int pstatus = 400;
+    if (!parse_http_request_headers(header_blob, req, perr, pstatus)) {
       LOG_WARN("Bad request: " + perr);
-      send_error(client_fd, 400, false);
+      entry.method = req.method;
+      entry.target = req.target;
+      send_error(conn, pstatus, false);
       return;
     }
+    req.head = std::move(header_blob);
+    conn.set_head_request(req.method == "HEAD");
+    const uint64_t headers_ns = mono_ns();
+    entry.rec.headers_ns = headers_ns;
+    entry.method = req.method;
+    entry.target = req.target;
 
     bool ka = wants_keepalive(req, cfg);
     LOG_INFO(req.method + " " + req.target + " (" + (ka ? "keep-alive" : "close") + ")");
 
-    std::string next_pending;
-    if (!drain_body(client_fd, cfg, req.content_length, after, next_pending)) {
+    auto exp = req.headers.find("expect");
+    bool expect_continue = req.version == "HTTP/1.1" && exp != req.headers.end() &&
+                           to_lower(exp->second) == "100-continue";
+
+    BodyReader body(conn, req.content_length, std::move(after), expect_continue);
+    RequestContext ctx{conn, cfg, req, body, ka};
+
+    std::string req_path, req_query;
+    split_target(req.target, req_path, req_query);
+
+    const ProxyRouteConfig* proxy = nullptr;
+    if (admin && is_admin_path(req_path)) {
+      admin_router().dispatch(ctx, req_path);
+    } else if ((proxy = find_proxy_route(cfg, req_path))) {
+      handle_proxy(ctx, *proxy);
+    } else {
+      router().dispatch(ctx, req_path);
+    }
+
+    entry.rec.body_done_ns = body.content_length() == 0 ? headers_ns : body.done_ns();
+    entry.rec.bytes_in = header_end + (body.content_length() - body.remaining());
+    if (ka && body.done() && !ctx.force_close) entry.rec.flags |= kAccessKeepAlive;
+
+    pending = body.take_leftover();
+    buf_mem.resize(base + pending.capacity());
+
+    handled++;
+    if (!ka || !body.done() || ctx.force_close) break;
+  }
+}
+
+// buf_mem is the reservation taken at accept; the connection keeps it.
+static void handle_client(int client_fd, std::string peer, bool tls, bool admin, uint64_t accept_ns, MemCharge buf_mem) {
+  struct Guard {
+    ~Guard() { g_active_clients.fetch_sub(1); }
+  } guard;
+
+  Connection conn(client_fd, std::move(peer));
+  const uint64_t conn_id = g_next_conn_id.fetch_add(1);
+
+  if (tls) {
+    std::shared_ptr<TlsContext> ctx = g_tls.load();
+    conn.set_timeout_sec(g_config.load()->keep_alive_timeout_sec);
+    std::string err;
+    if (!ctx || !conn.start_tls(ctx->get(), err)) {
+      LOG_DEBUG("TLS handshake with " + conn.peer() + " failed: " + err);
       return;
     }
-    pending = std::move(next_pending);
+    LOG_DEBUG(std::string("TLS with ") + conn.peer() + ": " + SSL_get_version(conn.ssl()) + " " +
+              SSL_get_cipher_name(conn.ssl()) + (SSL_session_reused(conn.ssl()) ? ", resumed" : "") +
+              ", kTLS tx=" + (conn.ktls_send() ? "on" : "off") + " rx=" + (conn.ktls_recv() ? "on" : "off"));
+  }
+
+  try {
+    serve_requests(conn, admin, conn_id, accept_ns, buf_mem);
+  } catch (const std::exception& e) {
+    // A handler bug must cost this connection, not the process.
+    LOG_ERROR("Request from " + conn.peer() + " failed: " + e.what() + "; closing connection");
+  }
+}
+
+HttpServer::HttpServer(ServerConfig cfg, std::string config_path, std::vector<std::string> argv)
+  : cfg_(std::move(cfg)), config_path_(std::move(config_path)), argv_(std::move(argv)) {}
+
+bool HttpServer::open_listeners() {
+  std::vector<std::pair<std::string, int>> inherited;
+  int handoff_sock = -1;
+
+  if (const char* env = std::getenv(kHandoffEnv)) {
+    handoff_sock = std::atoi(env);
+    ::unsetenv(kHandoffEnv);
+    ::fcntl(handoff_sock, F_SETFD, FD_CLOEXEC);
+
+    std::string err;
+    if (!receive_listeners(handoff_sock, inherited, err)) {
+      LOG_ERROR("Listener handoff failed, binding fresh sockets: " + err);
+    } else {
+      LOG_INFO("Inherited " + std::to_string(inherited.size()) + " listening socket(s)");
+    }
+  }
+
+  bool ok = true;
+  for (const auto& lc : cfg_.listeners) {
+    Listener l;
+    std::string err;
+    std::string name = listener_name(lc);
+
+    int fd = -1;
+    for (auto& kv : inherited) {
+      if (kv.second >= 0 && kv.first == name) { fd = kv.second; kv.second = -1; break; }
+    }
+
+    bool opened = (fd >= 0) ? adopt_listener(lc, fd, l, err) : open_listener(lc, l, err);
+    if (!opened) {
+      LOG_FATAL("Cannot listen on " + name + ": " + err);
+      ok = false;
+      break;
+    }
+    LOG_INFO(std::string(fd >= 0 ? "Accepting on inherited " : "Listening on ") + l.name +
+             " (backlog " + std::to_string(lc.backlog) + ")");
+    listeners_.push_back(std::move(l));
+  }
+
+  for (auto& kv : inherited) {
+    if (kv.second < 0) continue;
+    LOG_INFO("Closing inherited listener no longer configured: " + kv.first);
+    close_quiet(kv.second);
+  }
 
-    if (req.method == "GET" || req.method == "POST" || req.method == "DELETE") {
-      send_stub_response(client_fd, cfg, req);
+  if (handoff_sock >= 0) {
+    if (ok && !notify_upgrade_ready(handoff_sock)) {
+      LOG_WARN("Could not notify previous process; it keeps accepting");
+    }
+    close_quiet(handoff_sock);
+  }
+
+  if (!ok) {
+    for (auto& l : listeners_) close_listener(l);
+    listeners_.clear();
+  }
+  return ok;
+}
+
+void HttpServer::reload_config() {
+  ServerConfig next;
+  try {
+    next = load_config_json(config_path_);
+  } catch (const std::exception& e) {
+    LOG_ERROR(std::string("Config reload failed, keeping current config: ") + e.what());
+    return;
+  }
+
+  std::vector<std::string> before, after;
+  for (const auto& l : listeners_) {
+    before.push_back(l.name + (l.cfg.tls ? " tls" : "") + (l.cfg.admin ? " admin" : ""));
+  }
+  for (const auto& lc : next.listeners) {
+    after.push_back(listener_name(lc) + (lc.tls ? " tls" : "") + (lc.admin ? " admin" : ""));
+  }
+  if (before != after) {
+    LOG_WARN("Listener changes need a binary upgrade (SIGUSR2); keeping current sockets");
+  }
+
+  Logger::instance().configure(next.log_file, parse_level(next.log_level));
+  AccessLog::instance().configure(next);
+  configure_memory_budget(next);
+
+  if (tls_enabled(next)) {
+    std::string err;
+    std::shared_ptr<TlsContext> cur = g_tls.load();
+    if (auto t = TlsContext::create(next, cur.get(), err)) {
+      g_tls.store(std::move(t));
     } else {
-      send_error(client_fd, 501, ka);
+      LOG_ERROR("TLS reload failed, keeping current certificate: " + err);
     }
+  }
 
-    handled++;
-    if (!ka) break;
+  cfg_ = next;
+  configure_proxy(next);
+  g_config.store(std::make_shared<const ServerConfig>(std::move(next)));
+  LOG_INFO("Config reloaded from " + config_path_);
+}
+
+void HttpServer::start_upgrade() {
+  if (upgrade_pid_ > 0 || upgrade_sock_ >= 0) {
+    LOG_WARN("Upgrade already in progress (pid " + std::to_string(upgrade_pid_) + ")");
+    return;
+  }
+
+  std::string err;
+  int sock = -1;
+  pid_t pid = spawn_upgrade(argv_, sock, err);
+  if (pid < 0) {
+    LOG_ERROR("Upgrade failed: " + err);
+    return;
   }
+  upgrade_pid_ = pid;
+  LOG_INFO("Started new binary (pid " + std::to_string(pid) + "), handing off listeners");
+
+  if (!send_listeners(sock, listeners_, err)) {
+    close_quiet(sock);
+    ::kill(upgrade_pid_, SIGTERM);
+    LOG_ERROR("Upgrade failed, continuing to serve: " + err);
+    return;
+  }
+  upgrade_sock_ = sock;
+  upgrade_deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(10);
 }
 
-HttpServer::HttpServer(ServerConfig cfg) : cfg_(std::move(cfg)) {}
+// Called once the handoff socket is readable (ready byte or hangup) or the
+// deadline has passed.
+void HttpServer::finish_upgrade(bool timed_out) {
+  std::string err = "new process did not become ready in time";
+  bool ok = !timed_out && wait_upgrade_ready(upgrade_sock_, 0, err);
+  close_quiet(upgrade_sock_);
+  upgrade_sock_ = -1;
+
+  if (!ok) {
+    // The child may still come up later and start accepting on the shared
+    // listeners; stop it. reap_children() clears upgrade_pid_ once it exits.
+    if (upgrade_pid_ > 0) ::kill(upgrade_pid_, SIGTERM);
+    LOG_ERROR("Upgrade failed, continuing to serve: " + err);
+    return;
+  }
 
-int HttpServer::run() {
-  int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd < 0) {
-    LOG_FATAL(std::string("socket() failed: ") + std::strerror(errno));
-    return 1;
+  LOG_INFO("New process is accepting; draining and exiting");
+  g_draining.store(true);
+}
+
+void HttpServer::reap_children() {
+  int status = 0;
+  pid_t pid;
+  while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+    if (pid == upgrade_pid_) {
+      LOG_WARN("Upgraded process " + std::to_string(pid) + " exited");
+      upgrade_pid_ = -1;
+    }
   }
+}
 
-  int yes = 1;
-  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+int HttpServer::drain() {
+  for (auto& l : listeners_) close_listener(l);
+  listeners_.clear();
+  g_draining.store(true);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(cfg_.drain_timeout_sec);
+  while (g_active_clients.load() > 0) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      LOG_WARN("Drain timeout, exiting with " + std::to_string(g_active_clients.load()) + " active client(s)");
+      AccessLog::instance().shutdown();
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
 
-  sockaddr_in addr{};
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(cfg_.port);
+  LOG_INFO("All connections drained, exiting");
+  AccessLog::instance().shutdown();
+  return 0;
+}
 
-  if (::inet_pton(AF_INET, cfg_.server_ip.c_str(), &addr.sin_addr) != 1) {
-    LOG_FATAL("Invalid server_ip: " + cfg_.server_ip);
-    close_quiet(listen_fd);
+int HttpServer::run() {
+  ::signal(SIGPIPE, SIG_IGN);
+
+  // Blocked here so every client thread inherits the mask; the signals are
+  // consumed synchronously through a signalfd in the accept loop.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR2);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGCHLD);
+  ::pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+  int sig_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sig_fd < 0) {
+    LOG_FATAL(std::string("signalfd() failed: ") + std::strerror(errno));
     return 1;
   }
 
-  if (::bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-    LOG_FATAL(std::string("bind() failed: ") + std::strerror(errno));
-    close_quiet(listen_fd);
-    return 1;
+  configure_proxy(cfg_);
+  g_config.store(std::make_shared<const ServerConfig>(cfg_));
+  AccessLog::instance().configure(cfg_);
+  configure_memory_budget(cfg_);
+  add_memory_shrinker(dirlist_cache_trim);
+  router();
+  admin_router();
+
+  if (tls_enabled(cfg_)) {
+    std::string err;
+    std::shared_ptr<TlsContext> t = TlsContext::create(cfg_, nullptr, err);
+    if (!t) {
+      LOG_FATAL("TLS setup failed: " + err);
+      close_quiet(sig_fd);
+      return 1;
+    }
+    g_tls.store(std::move(t));
   }
 
-  if (::listen(listen_fd, (int)cfg_.max_clients) < 0) {
-    LOG_FATAL(std::string("listen() failed: ") + std::strerror(errno));
-    close_quiet(listen_fd);
+  if (!open_listeners()) {
+    close_quiet(sig_fd);
     return 1;
   }
 
-  LOG_INFO("Listening on " + cfg_.server_ip + ":" + std::to_string(cfg_.port));
-
-  while (true) {
-    sockaddr_in caddr{};
-    socklen_t clen = sizeof(caddr);
+  std::vector<pollfd> pfds(listeners_.size() + 2);
+  for (size_t i = 0; i < listeners_.size(); i++) {
+    pfds[i].fd = listeners_[i].fd;
+    pfds[i].events = POLLIN;
+  }
+  pollfd& sig_pfd = pfds[listeners_.size()];
+  sig_pfd.fd = sig_fd;
+  sig_pfd.events = POLLIN;
+  pollfd& upgrade_pfd = pfds.back();
+  upgrade_pfd.events = POLLIN;
+
+  while (!g_draining.load()) {
+    // poll() skips a negative fd, so the slot is inert without an upgrade.
+    upgrade_pfd.fd = upgrade_sock_;
+    upgrade_pfd.revents = 0;
+    int timeout = -1;
+    if (upgrade_sock_ >= 0) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(upgrade_deadline_ - std::chrono::steady_clock::now());
+      timeout = (int)std::max<int64_t>(0, left.count());
+    }
 
-    int client_fd = ::accept(listen_fd, (sockaddr*)&caddr, &clen);
-    if (client_fd < 0) {
+    int r = ::poll(pfds.data(), pfds.size(), timeout);
+    if (r < 0) {
       if (errno == EINTR) continue;
-      LOG_ERROR(std::string("accept() failed: ") + std::strerror(errno));
+      LOG_ERROR(std::string("poll() failed: ") + std::strerror(errno));
       continue;
     }
 
-    uint32_t cur = g_active_clients.load();
-    if (cur >= cfg_.max_clients) {
-      LOG_WARN("Max clients reached, sending 503");
-      send_error(client_fd, 503, false);
-      close_quiet(client_fd);
-      continue;
+    if (sig_pfd.revents & POLLIN) {
+      signalfd_siginfo si{};
+      while (::read(sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+        switch (si.ssi_signo) {
+          case SIGHUP:  reload_config(); break;
+          case SIGUSR2: start_upgrade(); break;
+          case SIGCHLD: reap_children(); break;
+          case SIGTERM:
+          case SIGINT:
+            LOG_INFO("Shutdown requested, draining");
+            g_draining.store(true);
+            break;
+        }
+      }
+      if (g_draining.load()) break;
+    }
+
+    if (upgrade_pfd.fd >= 0 && upgrade_pfd.fd == upgrade_sock_) {
+      if (upgrade_pfd.revents) finish_upgrade(false);
+      else if (std::chrono::steady_clock::now() >= upgrade_deadline_) finish_upgrade(true);
+      if (g_draining.load()) break;
     }
 
-    g_active_clients.fetch_add(1);
-    std::thread([client_fd, cfg = cfg_]() { handle_client(client_fd, cfg); }).detach();
+    for (size_t i = 0; i < listeners_.size(); i++) {
+      if (!(pfds[i].revents & POLLIN)) continue;
+
+      while (true) {
+        std::string peer;
+        int client_fd = accept_connection(listeners_[i], peer);
+        const uint64_t accept_ns = mono_ns();
+        if (client_fd < 0) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+          if (errno == ECONNABORTED || errno == EPROTO) continue;
+          LOG_ERROR("accept4() on " + listeners_[i].name + " failed: " + std::strerror(errno));
+          if (errno == EMFILE || errno == ENFILE) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          }
+          break;
+        }
+
+        bool tls = listeners_[i].cfg.tls;
+        bool admin = listeners_[i].cfg.admin;
+        std::string refuse;
+        MemCharge reservation(MemCategory::Connections);
+        if (g_active_clients.load() >= cfg_.max_clients) {
+          refuse = "Max clients reached";
+        } else if (!mem_reserve(reservation, request_reservation(*g_config.load(), tls))) {
+          refuse = "Memory budget exhausted";
+          mem_note_rejected();
+        }
+        if (!refuse.empty() && tls) {
+          // A plaintext 503 means nothing to a TLS client, and a handshake
+          // here would stall the accept loop.
+          LOG_WARN(refuse + ", closing TLS connection");
+          close_quiet(client_fd);
+          continue;
+        }
+        if (!refuse.empty()) {
+          LOG_WARN(refuse + ", sending 503");
+          Connection conn(client_fd, std::move(peer));
+          conn.set_timeout_sec(1);
+          send_error(conn, 503, false);
+          continue;
+        }
+
+        g_active_clients.fetch_add(1);
+        std::thread([client_fd, peer = std::move(peer), tls, admin, accept_ns, mem = std::move(reservation)]() mutable {
+          handle_client(client_fd, std::move(peer), tls, admin, accept_ns, std::move(mem));
+        }).detach();
+      }
+    }
   }
 
-  close_quiet(listen_fd);
-  return 0;
+  close_quiet(sig_fd);
+  return drain();
 }
 
 }
@@ -0,0 +1,391 @@
+#include "storage.hpp"
+#include "cas.hpp"
+#include "dirlist.hpp"
+#include "json_util.hpp"
+#include "logger.hpp"
+#include "memory_budget.hpp"
+#include "net.hpp"
+#include "response.hpp"
+#include "router.hpp"
+#include "utils.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+namespace fs = std::filesystem;
+
+static constexpr const char* kDigestXattr = "user.minihttpd.digest";
+
+HashingFileWriter::HashingFileWriter(int fd, bool sha256) : fd_(fd) {
+  if (sha256) sha_ = std::make_unique<Sha256>();
+}
+
+bool HashingFileWriter::write(const void* data, size_t len) {
+  crc_.update(data, len);
+  if (sha_) sha_->update(data, len);
+  bytes_ += len;
+  return write_all(fd_, data, len);
+}
+
+DigestValues HashingFileWriter::finish() {
+  DigestValues d;
+  d.crc32c = crc32c_b64(crc_.value());
+  if (sha_) {
+    auto h = sha_->finish();
+    d.sha256 = base64_encode(h.data(), h.size());
+  }
+  return d;
+}
+
+static std::string stat_stamp(const struct stat& st) {
+  return std::to_string(st.st_size) + ";" + std::to_string(st.st_mtim.tv_sec) + "." +
+         std::to_string(st.st_mtim.tv_nsec);
+}
+
+bool store_digest_xattr(int fd, const DigestValues& d) {
+  struct stat st{};
+  if (::fstat(fd, &st) < 0) return false;
+
+  std::string v = format_digest_header(d) + ";" + stat_stamp(st);
+  if (::fsetxattr(fd, kDigestXattr, v.data(), v.size(), 0) < 0) {
+    LOG_DEBUG(std::string("fsetxattr(") + kDigestXattr + ") failed: " + std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool load_digest_xattr(int fd, DigestValues& d) {
+  char buf[512];
+  ssize_t n = ::fgetxattr(fd, kDigestXattr, buf, sizeof(buf));
+  if (n <= 0) return false;
+
+  std::string v(buf, (size_t)n);
+  auto semi = v.find(';');
+  if (semi == std::string::npos) return false;
+
+  struct stat st{};
+  if (::fstat(fd, &st) < 0 || v.substr(semi + 1) != stat_stamp(st)) return false;
+
+  d = parse_digest_header(v.substr(0, semi));
+  return !d.crc32c.empty() || !d.sha256.empty();
+}
+
+bool digest_file(int fd, bool sha256, DigestValues& d) {
+  Crc32c crc;
+  std::unique_ptr<Sha256> sha;
+  if (sha256) sha = std::make_unique<Sha256>();
+
+  // A smaller buffer only costs more syscalls, so over budget use one.
+  MemCharge mem(MemCategory::RequestBodies);
+  std::vector<char> buf(mem_reserve(mem, 1 << 20) ? 1 << 20 : 64 * 1024);
+  off_t off = 0;
+  for (;;) {
+    ssize_t n = ::pread(fd, buf.data(), buf.size(), off);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) break;
+    crc.update(buf.data(), (size_t)n);
+    if (sha) sha->update(buf.data(), (size_t)n);
+    off += n;
+  }
+
+  d = DigestValues{};
+  d.crc32c = crc32c_b64(crc.value());
+  if (sha) {
+    auto h = sha->finish();
+    d.sha256 = base64_encode(h.data(), h.size());
+  }
+  return true;
+}
+
+bool digests_match(const DigestValues& computed, const DigestValues& expected) {
+  if (!expected.crc32c.empty() && expected.crc32c != computed.crc32c) return false;
+  if (!expected.sha256.empty() && expected.sha256 != computed.sha256) return false;
+  return true;
+}
+
+bool wants_sha256(const RequestContext& ctx) {
+  if (ctx.cfg.upload_digest_sha256 || cas_enabled(ctx.cfg)) return true;
+
+  auto d = ctx.req.headers.find("digest");
+  if (d != ctx.req.headers.end() && !parse_digest_header(d->second).sha256.empty()) return true;
+
+  auto w = ctx.req.headers.find("want-digest");
+  return w != ctx.req.headers.end() && want_digest_has(w->second, "sha-256");
+}
+
+void handle_file_get(RequestContext& ctx) {
+  bool ka = ctx.reply_keep_alive();
+
+  std::string path, query;
+  split_target(ctx.req.target, path, query);
+
+  bool ok = false;
+  fs::path full = safe_join_under_root(ctx.cfg.root_dir, path, ok);
+  if (!ok) {
+    send_error(ctx.conn, 403, ka);
+    return;
+  }
+
+  int fd = ::open(full.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    send_error(ctx.conn, (errno == EACCES) ? 403 : 404, ka);
+    return;
+  }
+  struct FdGuard {
+    int fd;
+    ~FdGuard() { close_quiet(fd); }
+  } guard{fd};
+
+  struct stat st{};
+  if (::fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+    handle_dir_listing(ctx, fd, path, query);
+    return;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    send_error(ctx.conn, 403, ka, "not a regular file");
+    return;
+  }
+
+  HttpResponseHead head;
+  head.status = 200;
+  head.headers["Content-Type"] = content_type_for_path(full.string());
+  head.headers["Content-Length"] = std::to_string(st.st_size);
+
+  DigestValues d;
+  if (load_digest_xattr(fd, d)) head.headers["Digest"] = format_digest_header(d);
+
+  if (!send_head(ctx.conn, std::move(head), ka)) return;
+  if (ctx.req.method == "HEAD") return;
+
+  if (!ctx.conn.send_file(fd, 0, (uint64_t)st.st_size)) {
+    LOG_DEBUG("sendfile aborted for " + full.string() + ": " + std::strerror(errno));
+  }
+}
+
+static void send_put_reply(RequestContext& ctx, const std::string& path, uint64_t size, const DigestValues& d,
+                           bool existed, bool deduplicated) {
+  nlohmann::json j;
+  j["path"] = "/" + fs::path(path).relative_path().lexically_normal().string();
+  j["size"] = size;
+  j["crc32c"] = d.crc32c;
+  if (!d.sha256.empty()) j["sha-256"] = d.sha256;
+  if (cas_enabled(ctx.cfg)) j["deduplicated"] = deduplicated;
+
+  HttpResponseHead head;
+  head.status = existed ? 200 : 201;
+  head.headers["Content-Type"] = "application/json; charset=utf-8";
+  head.headers["Digest"] = format_digest_header(d);
+  send_response(ctx.conn, std::move(head), dump_json(j), ctx.reply_keep_alive());
+}
+
+// Links the name to a blob the client already identified by hash. A client
+// still waiting for 100-continue never sends the body; otherwise it is
+// drained so the connection stays usable.
+static bool put_known_blob(RequestContext& ctx, const std::string& path, const std::string& sha_hex,
+                           const fs::path& final_path, bool existed) {
+  std::string err;
+  if (!cas_link_existing(ctx.cfg, sha_hex, final_path, err)) {
+    if (err.empty()) return false;
+    LOG_ERROR("CAS link for " + final_path.string() + " failed: " + err);
+    send_error(ctx.conn, 500, false, "cannot store file");
+    return true;
+  }
+
+  int fd = ::open(final_path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st{};
+  DigestValues d;
+  if (fd >= 0) {
+    ::fstat(fd, &st);
+    load_digest_xattr(fd, d);
+    close_quiet(fd);
+  }
+
+  if (ctx.body.awaiting_continue()) {
+    ctx.force_close = true;
+  } else if (!ctx.body.discard(ctx.cfg.recv_chunk_size)) {
+    return true;
+  }
+
+  LOG_INFO("Deduplicated upload of " + path + " (sha-256 " + sha_hex + ")");
+  send_put_reply(ctx, path, (uint64_t)st.st_size, d, existed, true);
+  return true;
+}
+
+void handle_file_put(RequestContext& ctx) {
+  const ServerConfig& cfg = ctx.cfg;
+
+  std::string path, query;
+  split_target(ctx.req.target, path, query);
+
+  if (path.empty() || path.back() == '/') {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "PUT needs a file path");
+    return;
+  }
+  if (ctx.body.content_length() > cfg.upload_max_total_bytes) {
+    send_error(ctx.conn, 413, false, "body exceeds upload_max_total_bytes");
+    return;
+  }
+
+  bool ok = false;
+  fs::path final_path = safe_join_under_root(cfg.root_dir, path, ok);
+  if (!ok) {
+    send_error(ctx.conn, 403, ctx.reply_keep_alive());
+    return;
+  }
+  std::error_code ec;
+  if (!fs::is_directory(final_path.parent_path(), ec)) {
+    send_error(ctx.conn, 404, ctx.reply_keep_alive(), "parent directory does not exist");
+    return;
+  }
+  if (fs::is_directory(final_path, ec)) {
+    send_error(ctx.conn, 409, ctx.reply_keep_alive(), "target is a directory");
+    return;
+  }
+  bool existed = fs::exists(final_path, ec);
+
+  DigestValues expected;
+  auto dh = ctx.req.headers.find("digest");
+  if (dh != ctx.req.headers.end()) expected = parse_digest_header(dh->second);
+
+  const bool cas = cas_enabled(cfg);
+  if (cas && !expected.sha256.empty()) {
+    std::string hex = sha256_b64_to_hex(expected.sha256);
+    if (!hex.empty() && put_known_blob(ctx, path, hex, final_path, existed)) return;
+  }
+
+  fs::path temp = cas ? cas_temp_path(cfg) : temp_path_for(final_path);
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("open(" + temp.string() + ") failed: " + std::strerror(errno));
+    send_error(ctx.conn, 500, ctx.reply_keep_alive(), "cannot create file");
+    return;
+  }
+  struct TempGuard {
+    int fd;
+    fs::path path;
+    bool keep = false;
+    ~TempGuard() {
+      close_quiet(fd);
+      if (!keep) ::unlink(path.c_str());
+    }
+  } guard{fd, temp};
+
+  HashingFileWriter w(fd, wants_sha256(ctx));
+  MemCharge mem(MemCategory::RequestBodies);
+  if (!reserve_or_503(ctx, mem, cfg.recv_chunk_size)) return;
+  std::vector<char> buf(cfg.recv_chunk_size);
+  while (!ctx.body.done()) {
+    ssize_t n = ctx.body.read(buf.data(), buf.size());
+    if (n < 0) {
+      LOG_WARN("Upload aborted by client: " + path);
+      return;
+    }
+    if (!w.write(buf.data(), (size_t)n)) {
+      LOG_ERROR("write(" + temp.string() + ") failed: " + std::strerror(errno));
+      send_error(ctx.conn, errno == ENOSPC ? 507 : 500, false, "cannot write file");
+      return;
+    }
+  }
+
+  DigestValues got = w.finish();
+  if (!digests_match(got, expected)) {
+    LOG_WARN("Digest mismatch for " + path + ": got " + format_digest_header(got));
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "body does not match the Digest header");
+    return;
+  }
+
+  // In CAS mode the xattr is how a name finds its blob again when it is
+  // overwritten or deleted; without it the blob could never be released.
+  if (!store_digest_xattr(fd, got) && cas) {
+    LOG_ERROR("Cannot record the digest of " + temp.string() + "; CAS needs xattr support");
+    send_error(ctx.conn, 500, ctx.reply_keep_alive(), "cannot store file");
+    return;
+  }
+
+  bool deduplicated = false;
+  if (cas) {
+    std::string err;
+    if (!cas_commit(cfg, temp, sha256_b64_to_hex(got.sha256), final_path, deduplicated, err)) {
+      LOG_ERROR("CAS commit for " + final_path.string() + " failed: " + err);
+      send_error(ctx.conn, 500, ctx.reply_keep_alive(), "cannot store file");
+      return;
+    }
+  } else if (::rename(temp.c_str(), final_path.c_str()) < 0) {
+    LOG_ERROR("rename(" + final_path.string() + ") failed: " + std::strerror(errno));
+    send_error(ctx.conn, 500, ctx.reply_keep_alive(), "cannot store file");
+    return;
+  }
+  guard.keep = true;
+
+  send_put_reply(ctx, path, w.bytes(), got, existed, deduplicated);
+}
+
+void handle_file_delete(RequestContext& ctx) {
+  bool ka = ctx.reply_keep_alive();
+
+  std::string path, query;
+  split_target(ctx.req.target, path, query);
+
+  bool ok = false;
+  fs::path full = safe_join_under_root(ctx.cfg.root_dir, path, ok);
+  if (!ok) {
+    send_error(ctx.conn, 403, ka);
+    return;
+  }
+
+  struct stat st{};
+  if (::lstat(full.c_str(), &st) < 0) {
+    send_error(ctx.conn, 404, ka);
+    return;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    send_error(ctx.conn, 403, ka, "not a regular file");
+    return;
+  }
+
+  bool freed = false;
+  std::string err;
+  if (cas_enabled(ctx.cfg)) {
+    ok = cas_remove(ctx.cfg, full, freed, err);
+  } else {
+    ok = ::unlink(full.c_str()) == 0;
+    if (!ok) err = std::strerror(errno);
+  }
+  if (!ok) {
+    LOG_ERROR("delete(" + full.string() + ") failed: " + err);
+    send_error(ctx.conn, 500, ka, "cannot delete file");
+    return;
+  }
+
+  nlohmann::json j;
+  j["path"] = "/" + fs::path(path).relative_path().lexically_normal().string();
+  j["deleted"] = true;
+  if (cas_enabled(ctx.cfg)) j["blob_freed"] = freed;
+  send_json(ctx.conn, 200, dump_json(j), ka);
+}
+
+void register_storage_routes(Router& r) {
+  r.add(kMethodGet | kMethodHead, "/*path", [](RequestContext& ctx, const RouteParams&) { handle_file_get(ctx); },
+        false);
+  r.add(kMethodPut, "/*path", [](RequestContext& ctx, const RouteParams&) { handle_file_put(ctx); });
+  r.add(kMethodDelete, "/*path", [](RequestContext& ctx, const RouteParams&) { handle_file_delete(ctx); }, false);
+
+  r.add(kMethodAny, std::string("/") + kCasDir + "/*rest",
+        [](RequestContext& ctx, const RouteParams&) { send_error(ctx.conn, 404, ctx.reply_keep_alive()); }, false);
+}
+
+}
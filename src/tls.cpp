@@ -0,0 +1,98 @@
+#include "tls.hpp"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace minihttpd {
+
+static constexpr unsigned char kSessionIdContext[] = "minihttpd";
+
+// 16-byte key name + HMAC key + AES key, as SSL_CTX_{get,set}_tlsext_ticket_keys expect.
+static constexpr size_t kTicketKeysLen = 80;
+
+bool tls_enabled(const ServerConfig& cfg) {
+  for (const auto& lc : cfg.listeners) {
+    if (lc.tls) return true;
+  }
+  return false;
+}
+
+std::string tls_error_string() {
+  std::string out;
+  unsigned long e;
+  while ((e = ERR_get_error()) != 0) {
+    char buf[256];
+    ERR_error_string_n(e, buf, sizeof(buf));
+    if (!out.empty()) out += "; ";
+    out += buf;
+  }
+  return out.empty() ? "unknown TLS error" : out;
+}
+
+static int select_alpn(SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in,
+                       unsigned int inlen, void*) {
+  static const unsigned char http11[] = "\x08http/1.1";
+  unsigned char* sel = nullptr;
+  if (SSL_select_next_proto(&sel, outlen, http11, sizeof(http11) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = sel;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+std::shared_ptr<TlsContext> TlsContext::create(const ServerConfig& cfg, const TlsContext* previous,
+                                               std::string& err) {
+  ERR_clear_error();
+  SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    err = tls_error_string();
+    return nullptr;
+  }
+  std::shared_ptr<TlsContext> out(new TlsContext(ctx));
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+  uint64_t opts = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF;
+  if (!cfg.tls_session_tickets) opts |= SSL_OP_NO_TICKET;
+  if (cfg.tls_ktls) opts |= SSL_OP_ENABLE_KTLS;
+  SSL_CTX_set_options(ctx, opts);
+
+  // Non-blocking sockets: a write may complete in pieces, and idle
+  // keep-alive connections should not pin their record buffers.
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, cfg.tls_cert_file.c_str()) != 1) {
+    err = "cannot load " + cfg.tls_cert_file + ": " + tls_error_string();
+    return nullptr;
+  }
+  if (SSL_CTX_use_PrivateKey_file(ctx, cfg.tls_key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+    err = "cannot load " + cfg.tls_key_file + ": " + tls_error_string();
+    return nullptr;
+  }
+  if (SSL_CTX_check_private_key(ctx) != 1) {
+    err = "tls_key_file does not match tls_cert_file: " + tls_error_string();
+    return nullptr;
+  }
+
+  SSL_CTX_set_session_id_context(ctx, kSessionIdContext, sizeof(kSessionIdContext) - 1);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, cfg.tls_session_cache_size);
+
+  if (previous) {
+    unsigned char keys[kTicketKeysLen];
+    if (SSL_CTX_get_tlsext_ticket_keys(previous->get(), keys, sizeof(keys)) == 1) {
+      SSL_CTX_set_tlsext_ticket_keys(ctx, keys, sizeof(keys));
+    }
+    OPENSSL_cleanse(keys, sizeof(keys));
+  }
+
+  SSL_CTX_set_alpn_select_cb(ctx, select_alpn, nullptr);
+  return out;
+}
+
+TlsContext::~TlsContext() {
+  SSL_CTX_free(ctx_);
+}
+
+}
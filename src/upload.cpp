@@ -0,0 +1,329 @@
+#include "upload.hpp"
+#include "cas.hpp"
+#include "json_util.hpp"
+#include "logger.hpp"
+#include "memory_budget.hpp"
+#include "multipart.hpp"
+#include "net.hpp"
+#include "response.hpp"
+#include "router.hpp"
+#include "storage.hpp"
+#include "utils.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+namespace fs = std::filesystem;
+
+bool is_multipart_request(const HttpRequest& req) {
+  auto it = req.headers.find("content-type");
+  if (it == req.headers.end()) return false;
+  return to_lower(it->second).rfind("multipart/form-data", 0) == 0;
+}
+
+// Strips any client-side directory from a filename; empty on rejection.
+static std::string sanitize_filename(const std::string& name) {
+  auto slash = name.find_last_of("/\\");
+  std::string base = (slash == std::string::npos) ? name : name.substr(slash + 1);
+  base = trim(base);
+  if (base.empty() || base == "." || base == "..") return {};
+  if (base.find('\0') != std::string::npos) return {};
+  return base;
+}
+
+namespace {
+
+struct StoredFile {
+  std::string field;
+  std::string filename;
+  std::string url_path;
+  fs::path final_path;
+  fs::path temp_path;
+  uint64_t size = 0;
+  DigestValues digest;
+  bool deduplicated = false;
+  bool staged = false;  // CAS: temp_path is now a name of the blob
+};
+
+// Owns the temp files of one request; anything not committed is removed.
+struct MultipartUpload {
+  const ServerConfig& cfg;
+  fs::path dir;
+  std::string url_dir;
+  bool sha256;
+
+  std::vector<StoredFile> files;
+  StoredFile cur;
+  int cur_fd = -1;
+  std::unique_ptr<HashingFileWriter> writer;
+  DigestValues expected;
+  bool skipping = false;
+
+  int status = 400;
+  std::string detail = "malformed multipart body";
+  bool committed = false;
+
+  MultipartUpload(const ServerConfig& c, fs::path d, std::string u, bool sha)
+    : cfg(c), dir(std::move(d)), url_dir(std::move(u)), sha256(sha) {}
+
+  ~MultipartUpload() {
+    close_quiet(cur_fd);
+    if (!cur.temp_path.empty()) ::unlink(cur.temp_path.c_str());
+    if (committed) return;
+    for (const auto& f : files) {
+      if (f.staged) drop_name(f.temp_path);
+      else ::unlink(f.temp_path.c_str());
+    }
+  }
+
+  void drop_name(const fs::path& p) {
+    if (!cas_enabled(cfg)) {
+      ::unlink(p.c_str());
+      return;
+    }
+    bool freed = false;
+    std::string err;
+    cas_remove(cfg, p, freed, err);
+  }
+
+  bool reject(int st, const std::string& d) {
+    status = st;
+    detail = d;
+    return false;
+  }
+
+  bool begin(const MultipartPart& part) {
+    skipping = !part.has_filename;
+    if (skipping) return true;
+
+    std::string name = sanitize_filename(part.filename);
+    if (name.empty()) return reject(400, "invalid filename");
+    for (const auto& f : files) {
+      if (f.filename == name) return reject(400, "duplicate filename in one upload");
+    }
+
+    bool ok = false;
+    fs::path final_path = safe_join_under_root(cfg.root_dir, url_dir + "/" + name, ok);
+    if (!ok) return reject(403, "path outside of root");
+
+    cur = StoredFile{};
+    cur.field = part.name;
+    cur.filename = name;
+    cur.url_path = url_dir + "/" + name;
+    cur.final_path = final_path;
+    cur.temp_path = cas_enabled(cfg) ? cas_temp_path(cfg) : temp_path_for(final_path);
+
+    cur_fd = ::open(cur.temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (cur_fd < 0) {
+      LOG_ERROR("open(" + cur.temp_path.string() + ") failed: " + std::strerror(errno));
+      cur.temp_path.clear();
+      return reject(500, "cannot create file");
+    }
+
+    auto dh = part.headers.find("digest");
+    expected = (dh != part.headers.end()) ? parse_digest_header(dh->second) : DigestValues{};
+    writer = std::make_unique<HashingFileWriter>(cur_fd, sha256 || !expected.sha256.empty());
+    return true;
+  }
+
+  bool data(const char* p, size_t n) {
+    if (skipping) return true;
+
+    cur.size += n;
+    if (cur.size > cfg.upload_max_part_bytes) return reject(413, "part exceeds upload_max_part_bytes");
+
+    if (!writer->write(p, n)) {
+      LOG_ERROR("write(" + cur.temp_path.string() + ") failed: " + std::strerror(errno));
+      return reject(500, "cannot write file");
+    }
+    return true;
+  }
+
+  bool end() {
+    if (skipping) return true;
+
+    cur.digest = writer->finish();
+    writer.reset();
+    if (!digests_match(cur.digest, expected)) return reject(400, "part does not match its Digest header");
+    // CAS finds a name's blob through this xattr when releasing it.
+    if (!store_digest_xattr(cur_fd, cur.digest) && cas_enabled(cfg)) {
+      LOG_ERROR("Cannot record the digest of " + cur.temp_path.string() + "; CAS needs xattr support");
+      return reject(500, "cannot store file");
+    }
+
+    if (::close(cur_fd) < 0) {
+      cur_fd = -1;
+      return reject(500, "cannot write file");
+    }
+    cur_fd = -1;
+    files.push_back(std::move(cur));
+    cur = StoredFile{};
+    return true;
+  }
+
+  // All files or none: each is first put next to its final name under a
+  // hidden one, then all are renamed into place. Replaced files are kept as
+  // hard links until the end, so a failed rename can restore them.
+  bool commit() {
+    if (cas_enabled(cfg)) {
+      for (auto& f : files) {
+        std::string err;
+        fs::path staged = temp_path_for(f.final_path);
+        if (!cas_commit(cfg, f.temp_path, sha256_b64_to_hex(f.digest.sha256), staged, f.deduplicated, err)) {
+          LOG_ERROR("CAS commit for " + f.final_path.string() + " failed: " + err);
+          return reject(500, "cannot store file");
+        }
+        f.temp_path = staged;
+        f.staged = true;
+      }
+    }
+
+    std::vector<fs::path> backups(files.size());
+    size_t done = 0;
+    for (; done < files.size(); done++) {
+      const StoredFile& f = files[done];
+      fs::path backup = temp_path_for(f.final_path);
+      if (::link(f.final_path.c_str(), backup.c_str()) == 0) {
+        backups[done] = backup;
+      } else if (errno != ENOENT) {
+        LOG_ERROR("link(" + f.final_path.string() + ") failed: " + std::strerror(errno));
+        break;
+      }
+      if (::rename(f.temp_path.c_str(), f.final_path.c_str()) < 0) {
+        LOG_ERROR("rename(" + f.final_path.string() + ") failed: " + std::strerror(errno));
+        if (!backups[done].empty()) ::unlink(backups[done].c_str());
+        break;
+      }
+    }
+
+    if (done < files.size()) {
+      // The new content gets its hidden name back for the destructor to drop.
+      for (size_t i = done; i-- > 0;) {
+        const StoredFile& f = files[i];
+        ::link(f.final_path.c_str(), f.temp_path.c_str());
+        if (!backups[i].empty()) ::rename(backups[i].c_str(), f.final_path.c_str());
+        else ::unlink(f.final_path.c_str());
+      }
+      return reject(500, "cannot store file");
+    }
+
+    for (const auto& b : backups) {
+      if (!b.empty()) drop_name(b);
+    }
+    committed = true;
+    return true;
+  }
+};
+
+}
+
+void handle_multipart_upload(RequestContext& ctx) {
+  const ServerConfig& cfg = ctx.cfg;
+
+  std::string boundary;
+  if (!multipart_boundary(ctx.req.headers.at("content-type"), boundary)) {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "missing or invalid multipart boundary");
+    return;
+  }
+  if (ctx.body.content_length() == 0) {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "empty multipart body");
+    return;
+  }
+  if (ctx.body.content_length() > cfg.upload_max_total_bytes) {
+    send_error(ctx.conn, 413, false, "request exceeds upload_max_total_bytes");
+    return;
+  }
+
+  std::string path, query;
+  split_target(ctx.req.target, path, query);
+  while (path.size() > 1 && path.back() == '/') path.pop_back();
+  if (path == "/") path.clear();
+
+  bool ok = false;
+  fs::path dir = safe_join_under_root(cfg.root_dir, path, ok);
+  if (!ok) {
+    send_error(ctx.conn, 403, ctx.reply_keep_alive());
+    return;
+  }
+  std::error_code ec;
+  if (!fs::is_directory(dir, ec)) {
+    send_error(ctx.conn, 404, ctx.reply_keep_alive(), "upload directory does not exist");
+    return;
+  }
+
+  MultipartUpload up(cfg, dir, path, wants_sha256(ctx));
+
+  MultipartParser::Callbacks cb;
+  cb.on_part_begin = [&](const MultipartPart& p) { return up.begin(p); };
+  cb.on_part_data = [&](const char* d, size_t n) { return up.data(d, n); };
+  cb.on_part_end = [&]() { return up.end(); };
+  MultipartParser parser(boundary, std::move(cb));
+
+  MemCharge mem(MemCategory::RequestBodies);
+  if (!reserve_or_503(ctx, mem, cfg.recv_chunk_size)) return;
+  std::vector<char> buf(cfg.recv_chunk_size);
+  while (!ctx.body.done()) {
+    ssize_t n = ctx.body.read(buf.data(), buf.size());
+    if (n < 0) {
+      LOG_WARN("Upload aborted by client: " + ctx.req.target);
+      return;
+    }
+    if (!parser.feed(buf.data(), (size_t)n)) {
+      LOG_WARN("Multipart upload rejected: " + parser.error() + " (" + up.detail + ")");
+      send_error(ctx.conn, up.status, ctx.reply_keep_alive(), up.detail);
+      return;
+    }
+  }
+
+  if (!parser.finished()) {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "multipart body ended before the closing boundary");
+    return;
+  }
+  if (!up.commit()) {
+    send_error(ctx.conn, up.status, ctx.reply_keep_alive(), up.detail);
+    return;
+  }
+
+  nlohmann::json summary;
+  summary["files"] = nlohmann::json::array();
+  uint64_t total = 0;
+  for (const auto& f : up.files) {
+    summary["files"].push_back({
+      {"field", f.field},
+      {"filename", f.filename},
+      {"path", f.url_path},
+      {"size", f.size},
+      {"crc32c", f.digest.crc32c},
+    });
+    if (!f.digest.sha256.empty()) summary["files"].back()["sha-256"] = f.digest.sha256;
+    if (cas_enabled(cfg)) summary["files"].back()["deduplicated"] = f.deduplicated;
+    total += f.size;
+  }
+  summary["count"] = up.files.size();
+  summary["bytes"] = total;
+
+  LOG_INFO("Stored " + std::to_string(up.files.size()) + " file(s) under " + dir.string());
+  send_json(ctx.conn, 201, dump_json(summary), ctx.reply_keep_alive());
+}
+
+void register_upload_routes(Router& r) {
+  r.add(kMethodPost, "/*path", [](RequestContext& ctx, const RouteParams&) {
+    if (is_multipart_request(ctx.req)) {
+      handle_multipart_upload(ctx);
+    } else {
+      send_error(ctx.conn, 415, ctx.reply_keep_alive(), "POST expects a multipart/form-data body");
+    }
+  });
+}
+
+}
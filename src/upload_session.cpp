@@ -0,0 +1,454 @@
+#include "upload_session.hpp"
+#include "cas.hpp"
+#include "json_util.hpp"
+#include "logger.hpp"
+#include "memory_budget.hpp"
+#include "net.hpp"
+#include "range_set.hpp"
+#include "response.hpp"
+#include "router.hpp"
+#include "storage.hpp"
+#include "utils.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+namespace minihttpd {
+
+namespace fs = std::filesystem;
+using steady = std::chrono::steady_clock;
+
+// Disjoint received ranges one session may track. A range that would start a
+// new one past this is refused until the gaps between the others are filled.
+static constexpr size_t kMaxSessionRanges = 1024;
+
+namespace {
+
+struct UploadSession {
+  std::string id;
+  std::string url_path;
+  fs::path final_path;
+  fs::path temp_path;
+  uint64_t size = 0;
+  int fd = -1;
+
+  std::mutex mu;
+  RangeSet received;
+  uint32_t writers = 0;
+  bool closed = false;
+  bool finalized = false;
+  steady::time_point last_active = steady::now();
+
+  ~UploadSession() {
+    close_quiet(fd);
+    if (!finalized && !temp_path.empty()) ::unlink(temp_path.c_str());
+  }
+};
+
+using SessionPtr = std::shared_ptr<UploadSession>;
+
+std::mutex g_sessions_mu;
+std::unordered_map<std::string, SessionPtr> g_sessions;
+std::atomic<int64_t> g_last_sweep_ms{0};
+
+}
+
+bool is_upload_session_path(const std::string& path) {
+  const std::string prefix = kUploadSessionPrefix;
+  if (path.compare(0, prefix.size(), prefix) != 0) return false;
+  return path.size() == prefix.size() || path[prefix.size()] == '/';
+}
+
+static std::string random_id() {
+  unsigned char raw[16];
+  size_t got = 0;
+  while (got < sizeof(raw)) {
+    ssize_t n = ::getrandom(raw + got, sizeof(raw) - got, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    got += (size_t)n;
+  }
+
+  static const char* hex = "0123456789abcdef";
+  std::string id;
+  for (unsigned char c : raw) {
+    id.push_back(hex[c >> 4]);
+    id.push_back(hex[c & 15]);
+  }
+  return id;
+}
+
+static bool parse_u64(const std::string& s, uint64_t& out) {
+  if (s.empty() || s.size() > 19) return false;
+  uint64_t v = 0;
+  for (char c : s) {
+    if (!std::isdigit((unsigned char)c)) return false;
+    v = v * 10 + (uint64_t)(c - '0');
+  }
+  out = v;
+  return true;
+}
+
+// "bytes <first>-<last>/<total|*>"
+static bool parse_content_range(const std::string& v, uint64_t& first, uint64_t& last, bool& has_total, uint64_t& total) {
+  std::string s = trim(v);
+  if (to_lower(s.substr(0, 6)) != "bytes ") return false;
+  s = trim(s.substr(6));
+
+  auto dash = s.find('-');
+  auto slash = s.find('/');
+  if (dash == std::string::npos || slash == std::string::npos || dash > slash) return false;
+
+  if (!parse_u64(s.substr(0, dash), first)) return false;
+  if (!parse_u64(s.substr(dash + 1, slash - dash - 1), last)) return false;
+  if (last < first) return false;
+
+  std::string t = s.substr(slash + 1);
+  has_total = (t != "*");
+  if (has_total && !parse_u64(t, total)) return false;
+  return true;
+}
+
+// Closes the session if idle past the TTL; caller holds both locks.
+static bool expire_if_idle(UploadSession& s, steady::time_point cutoff) {
+  if (s.writers > 0 || s.last_active >= cutoff) return false;
+  LOG_INFO("Upload session " + s.id + " expired");
+  s.closed = true;
+  return true;
+}
+
+// Every request to /_uploads sweeps, so abandoned temp files go away while
+// the endpoint is in use; the table is walked at most once a second unless
+// forced.
+static void sweep_expired(const ServerConfig& cfg, bool force) {
+  auto now = steady::now();
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+  int64_t last = g_last_sweep_ms.load();
+  if (!force && (now_ms - last < 1000 || !g_last_sweep_ms.compare_exchange_strong(last, now_ms))) return;
+  auto cutoff = now - std::chrono::seconds(cfg.upload_session_ttl_sec);
+
+  std::lock_guard<std::mutex> lk(g_sessions_mu);
+  for (auto it = g_sessions.begin(); it != g_sessions.end();) {
+    auto& s = *it->second;
+    std::lock_guard<std::mutex> slk(s.mu);
+    if (expire_if_idle(s, cutoff)) it = g_sessions.erase(it);
+    else ++it;
+  }
+}
+
+static SessionPtr find_session(const ServerConfig& cfg, const std::string& id) {
+  sweep_expired(cfg, false);
+  auto cutoff = steady::now() - std::chrono::seconds(cfg.upload_session_ttl_sec);
+
+  std::lock_guard<std::mutex> lk(g_sessions_mu);
+  auto it = g_sessions.find(id);
+  if (it == g_sessions.end()) return nullptr;
+  SessionPtr s = it->second;
+  std::lock_guard<std::mutex> slk(s->mu);
+  if (expire_if_idle(*s, cutoff)) {
+    g_sessions.erase(it);
+    return nullptr;
+  }
+  return s;
+}
+
+static nlohmann::json session_json(UploadSession& s) {
+  nlohmann::json j;
+  j["id"] = s.id;
+  j["url"] = std::string(kUploadSessionPrefix) + "/" + s.id;
+  j["path"] = s.url_path;
+  j["size"] = s.size;
+  j["received"] = s.received.covered();
+  j["complete"] = s.received.covered() == s.size;
+  return j;
+}
+
+static void create_session(RequestContext& ctx, const std::string& query) {
+  const ServerConfig& cfg = ctx.cfg;
+  bool ka = ctx.reply_keep_alive();
+
+  std::string path, size_str;
+  uint64_t size = 0;
+  if (!query_param(query, "path", path) || !query_param(query, "size", size_str) || !parse_u64(size_str, size)) {
+    send_error(ctx.conn, 400, ka, "path and size query parameters are required");
+    return;
+  }
+  if (size > cfg.upload_max_total_bytes) {
+    send_error(ctx.conn, 413, ka, "size exceeds upload_max_total_bytes");
+    return;
+  }
+
+  bool ok = false;
+  fs::path final_path = safe_join_under_root(cfg.root_dir, path, ok);
+  std::error_code ec;
+  if (!ok || is_upload_session_path(path) || is_reserved_path(path)) {
+    send_error(ctx.conn, 403, ka);
+    return;
+  }
+  if (!fs::is_directory(final_path.parent_path(), ec) || fs::is_directory(final_path, ec)) {
+    send_error(ctx.conn, 404, ka, "parent directory does not exist");
+    return;
+  }
+
+  sweep_expired(cfg, true);
+  {
+    std::lock_guard<std::mutex> lk(g_sessions_mu);
+    if (g_sessions.size() >= cfg.upload_max_sessions) {
+      send_error(ctx.conn, 503, ka, "too many open upload sessions");
+      return;
+    }
+  }
+
+  auto s = std::make_shared<UploadSession>();
+  s->id = random_id();
+  s->url_path = "/" + fs::path(path).relative_path().lexically_normal().string();
+  s->final_path = final_path;
+  s->temp_path = temp_path_for(final_path);
+  s->size = size;
+
+  s->fd = ::open(s->temp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (s->fd < 0) {
+    LOG_ERROR("open(" + s->temp_path.string() + ") failed: " + std::strerror(errno));
+    s->temp_path.clear();
+    send_error(ctx.conn, 500, ka, "cannot create upload file");
+    return;
+  }
+
+  // Reserve the blocks up front: parallel ranges then land in place without
+  // fragmenting the file, and a full disk is reported now, not at 90%.
+  if (size > 0) {
+    int rc = ::posix_fallocate(s->fd, 0, (off_t)size);
+    if (rc == EOPNOTSUPP || rc == EINVAL) rc = (::ftruncate(s->fd, (off_t)size) == 0) ? 0 : errno;
+    if (rc != 0) {
+      LOG_ERROR("preallocating " + std::to_string(size) + " bytes failed: " + std::strerror(rc));
+      send_error(ctx.conn, rc == ENOSPC ? 507 : 500, ka, "cannot preallocate upload file");
+      return;
+    }
+  }
+
+  // The reply is built before the session is published: if anything here
+  // throws, s is the only owner and its destructor removes the temp file.
+  HttpResponseHead head;
+  head.status = 201;
+  head.headers["Content-Type"] = "application/json; charset=utf-8";
+  head.headers["Location"] = std::string(kUploadSessionPrefix) + "/" + s->id;
+  std::string body = dump_json(session_json(*s));
+
+  {
+    std::lock_guard<std::mutex> lk(g_sessions_mu);
+    g_sessions[s->id] = s;
+  }
+  LOG_INFO("Upload session " + s->id + " created for " + s->url_path + " (" + std::to_string(size) + " bytes)");
+  send_response(ctx.conn, std::move(head), body, ka);
+}
+
+static void write_range(RequestContext& ctx, const SessionPtr& s) {
+  auto cr = ctx.req.headers.find("content-range");
+  uint64_t first = 0, last = 0, total = 0;
+  bool has_total = false;
+  if (cr == ctx.req.headers.end() || !parse_content_range(cr->second, first, last, has_total, total)) {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "Content-Range: bytes a-b/N is required");
+    return;
+  }
+  if ((has_total && total != s->size) || last >= s->size) {
+    send_error(ctx.conn, 416, ctx.reply_keep_alive(), "range does not fit the upload size");
+    return;
+  }
+  if (ctx.body.content_length() != last - first + 1) {
+    send_error(ctx.conn, 400, ctx.reply_keep_alive(), "Content-Length does not match Content-Range");
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    if (s->closed) {
+      send_error(ctx.conn, 409, ctx.reply_keep_alive(), "upload session is being finalized");
+      return;
+    }
+    // Counting the ranges still being written keeps concurrent PUTs under the cap.
+    if (s->received.size() + s->writers >= kMaxSessionRanges && !s->received.touches(first, last + 1)) {
+      send_error(ctx.conn, 409, ctx.reply_keep_alive(), "too many disjoint ranges, fill the gaps first");
+      return;
+    }
+    s->writers++;
+    s->last_active = steady::now();
+  }
+  struct WriterGuard {
+    UploadSession& s;
+    ~WriterGuard() {
+      std::lock_guard<std::mutex> lk(s.mu);
+      s.writers--;
+      s.last_active = steady::now();
+    }
+  } guard{*s};
+
+  // Every chunk is credited as soon as it is on disk, so an interrupted PUT
+  // only has to resend what is still missing.
+  MemCharge mem(MemCategory::RequestBodies);
+  if (!reserve_or_503(ctx, mem, ctx.cfg.recv_chunk_size)) return;
+  std::vector<char> buf(ctx.cfg.recv_chunk_size);
+  uint64_t off = first;
+  while (!ctx.body.done()) {
+    ssize_t n = ctx.body.read(buf.data(), buf.size());
+    if (n < 0) {
+      LOG_WARN("Upload session " + s->id + ": client went away at offset " + std::to_string(off));
+      return;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)n) {
+      ssize_t w = ::pwrite(s->fd, buf.data() + done, (size_t)n - done, (off_t)(off + done));
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) {
+        LOG_ERROR("pwrite(" + s->temp_path.string() + ") failed: " + std::strerror(errno));
+        send_error(ctx.conn, errno == ENOSPC ? 507 : 500, false, "cannot write upload data");
+        return;
+      }
+      done += (size_t)w;
+    }
+
+    std::lock_guard<std::mutex> lk(s->mu);
+    s->received.add(off, off + (uint64_t)n);
+    off += (uint64_t)n;
+  }
+
+  nlohmann::json j;
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    j = session_json(*s);
+  }
+  send_json(ctx.conn, 200, dump_json(j), ctx.reply_keep_alive());
+}
+
+static void session_status(RequestContext& ctx, const SessionPtr& s) {
+  nlohmann::json j;
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    j = session_json(*s);
+    j["ranges"] = nlohmann::json::array();
+    for (const auto& r : s->received.ranges()) j["ranges"].push_back({r.first, r.second - 1});
+  }
+  send_json(ctx.conn, 200, dump_json(j), ctx.reply_keep_alive());
+}
+
+static void finalize_session(RequestContext& ctx, const SessionPtr& s) {
+  bool ka = ctx.reply_keep_alive();
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    if (s->closed) {
+      send_error(ctx.conn, 409, ka, "upload session is already being finalized");
+      return;
+    }
+    if (s->writers > 0) {
+      send_error(ctx.conn, 409, ka, "ranges are still being written");
+      return;
+    }
+    if (s->received.covered() != s->size) {
+      send_json(ctx.conn, 409, dump_json(session_json(*s)), ka);
+      return;
+    }
+    s->closed = true;
+  }
+
+  // Ranges arrive out of order, so in "cas" mode the hash needs one pass here.
+  bool stored = ::fsync(s->fd) == 0;
+  bool dedup = false;
+  DigestValues d;
+  std::string err;
+  if (stored && cas_enabled(ctx.cfg)) {
+    stored = digest_file(s->fd, true, d) && store_digest_xattr(s->fd, d) &&
+             cas_commit(ctx.cfg, s->temp_path, sha256_b64_to_hex(d.sha256), s->final_path, dedup, err);
+  } else if (stored) {
+    stored = ::rename(s->temp_path.c_str(), s->final_path.c_str()) == 0;
+  }
+  if (!stored) {
+    if (err.empty()) err = std::strerror(errno);
+    LOG_ERROR("finalizing " + s->final_path.string() + " failed: " + err);
+    std::lock_guard<std::mutex> lk(s->mu);
+    s->closed = false;
+    send_error(ctx.conn, 500, ka, "cannot store file");
+    return;
+  }
+
+  nlohmann::json j;
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    s->finalized = true;
+    j = session_json(*s);
+  }
+  if (cas_enabled(ctx.cfg)) {
+    j["sha-256"] = d.sha256;
+    j["deduplicated"] = dedup;
+  }
+  {
+    std::lock_guard<std::mutex> lk(g_sessions_mu);
+    g_sessions.erase(s->id);
+  }
+
+  LOG_INFO("Upload session " + s->id + " stored " + s->url_path);
+  send_json(ctx.conn, 201, dump_json(j), ka);
+}
+
+static void abort_session(RequestContext& ctx, const SessionPtr& s) {
+  {
+    std::lock_guard<std::mutex> lk(s->mu);
+    s->closed = true;
+  }
+  {
+    std::lock_guard<std::mutex> lk(g_sessions_mu);
+    g_sessions.erase(s->id);
+  }
+  LOG_INFO("Upload session " + s->id + " aborted");
+  send_json(ctx.conn, 200, "{\"aborted\":true}", ctx.reply_keep_alive());
+}
+
+// Resolves the :id capture, replying 404 for unknown sessions.
+static SessionPtr route_session(RequestContext& ctx, const RouteParams& p) {
+  SessionPtr s = find_session(ctx.cfg, std::string(p.get("id")));
+  if (!s) send_error(ctx.conn, 404, ctx.reply_keep_alive(), "unknown upload session");
+  return s;
+}
+
+void register_upload_session_routes(Router& r) {
+  const std::string base = kUploadSessionPrefix;
+
+  r.add(kMethodPost, base, [](RequestContext& ctx, const RouteParams&) {
+    std::string path, query;
+    split_target(ctx.req.target, path, query);
+    create_session(ctx, query);
+  });
+  r.add(kMethodPut, base + "/:id", [](RequestContext& ctx, const RouteParams& p) {
+    if (SessionPtr s = route_session(ctx, p)) write_range(ctx, s);
+  });
+  r.add(kMethodGet, base + "/:id", [](RequestContext& ctx, const RouteParams& p) {
+    if (SessionPtr s = route_session(ctx, p)) session_status(ctx, s);
+  }, false);
+  r.add(kMethodDelete, base + "/:id", [](RequestContext& ctx, const RouteParams& p) {
+    if (SessionPtr s = route_session(ctx, p)) abort_session(ctx, s);
+  }, false);
+  r.add(kMethodPost, base + "/:id/finalize", [](RequestContext& ctx, const RouteParams& p) {
+    if (SessionPtr s = route_session(ctx, p)) finalize_session(ctx, s);
+  }, false);
+
+  r.add(kMethodAny, base + "/*rest", [](RequestContext& ctx, const RouteParams&) {
+    send_error(ctx.conn, 404, ctx.reply_keep_alive());
+  }, false);
+}
+
+}
@@ -1,11 +1,21 @@
 #include "utils.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <sstream>
 #include <system_error>
 
+#include <time.h>
+#include <unistd.h>
+
 namespace minihttpd {
 
+uint64_t mono_ns() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 std::string trim(const std::string& s) {
   size_t b = 0;
   while (b < s.size() && std::isspace((unsigned char)s[b])) b++;
@@ -52,6 +62,24 @@ std::string url_decode(const std::string& s) {
   return out;
 }
 
+std::string url_encode(const std::string& s) {
+  static const char* hex = "0123456789ABCDEF";
+  std::string out;
+  out.reserve(s.size());
+
+  for (unsigned char c : s) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+      out.push_back((char)c);
+    } else {
+      out.push_back('%');
+      out.push_back(hex[c >> 4]);
+      out.push_back(hex[c & 0x0F]);
+    }
+  }
+
+  return out;
+}
+
 std::string html_escape(const std::string& s) {
   std::string out;
   out.reserve(s.size());
@@ -127,4 +155,27 @@ std::filesystem::path safe_join_under_root(const std::filesystem::path& root, co
   return joined;
 }
 
-} 
+std::filesystem::path temp_path_for(const std::filesystem::path& final_path) {
+  static std::atomic<uint64_t> counter{0};
+  std::string name = ".";
+  name.append(final_path.filename().string())
+      .append(".tmp-")
+      .append(std::to_string(::getpid()))
+      .append("-")
+      .append(std::to_string(counter.fetch_add(1)));
+  return final_path.parent_path() / name;
+}
+
+bool is_temp_name(std::string_view name) {
+  auto digits = [](std::string_view s) {
+    return !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isdigit(c); });
+  };
+  if (name.size() < 2 || name[0] != '.') return false;
+  size_t dash = name.rfind('-');
+  if (dash == std::string_view::npos || !digits(name.substr(dash + 1))) return false;
+  size_t tmp = name.rfind(".tmp-", dash);
+  if (tmp == std::string_view::npos || tmp < 2) return false;
+  return digits(name.substr(tmp + 5, dash - tmp - 5));
+}
+
+}
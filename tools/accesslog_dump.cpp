@@ -0,0 +1,178 @@
+// Converts a minihttpd access log to JSON lines, or summarizes phase
+// latencies with --stats.
+//
+//   minihttpd-accesslog [--stats] [--slow-only] <access_log_file>
+
+#include "access_log_format.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace minihttpd;
+using nlohmann::json;
+
+namespace {
+
+enum Phase { kWait, kHeaders, kBody, kHandler, kTotal, kPhaseCount };
+constexpr const char* kPhaseNames[kPhaseCount] = {"wait", "headers", "body", "handler", "total"};
+
+// Durations in ns; -1 when a phase did not happen. "wait" (accept to first
+// byte) only exists for the first request on a connection.
+void phases(const AccessRecord& r, int64_t out[kPhaseCount]) {
+  auto span = [](uint64_t from, uint64_t to) { return from && to && to >= from ? (int64_t)(to - from) : -1; };
+  out[kWait] = span(r.accept_ns, r.first_byte_ns);
+  out[kHeaders] = span(r.first_byte_ns, r.headers_ns);
+  out[kBody] = span(r.headers_ns, r.body_done_ns);
+  out[kHandler] = span(r.body_done_ns ? r.body_done_ns : r.headers_ns, r.flushed_ns);
+  out[kTotal] = span(r.first_byte_ns, r.flushed_ns);
+}
+
+std::string field(const char* s, size_t cap) {
+  return std::string(s, strnlen(s, cap));
+}
+
+double ms(int64_t ns) {
+  return (double)ns / 1e6;
+}
+
+// Nearest-rank percentile of a sorted sample.
+int64_t percentile(const std::vector<int64_t>& v, double p) {
+  size_t rank = (size_t)(p / 100.0 * (double)v.size() + 0.999999);
+  if (rank == 0) rank = 1;
+  return v[std::min(rank, v.size()) - 1];
+}
+
+void print_record(const AccessRecord& r, const AccessLogHeader& h) {
+  int64_t ph[kPhaseCount];
+  phases(r, ph);
+
+  json j;
+  // Records buffered across a reopen sit after the new header and may
+  // predate its base slightly.
+  int64_t since_base = (int64_t)(r.first_byte_ns - h.mono_base_ns);
+  j["time"] = ((double)h.wall_base_ns + (double)since_base) / 1e9;
+  j["conn"] = r.conn_id;
+  j["seq"] = r.seq;
+  j["peer"] = field(r.peer, sizeof(r.peer));
+  j["method"] = field(r.method, sizeof(r.method));
+  j["target"] = field(r.target, sizeof(r.target));
+  j["status"] = r.status;
+  j["bytes_in"] = r.bytes_in;
+  j["bytes_out"] = r.bytes_out;
+  j["tls"] = (r.flags & kAccessTls) != 0;
+  j["keep_alive"] = (r.flags & kAccessKeepAlive) != 0;
+  j["slow"] = (r.flags & kAccessSlow) != 0;
+  json p = json::object();
+  for (int i = 0; i < kPhaseCount; i++) {
+    if (ph[i] >= 0) p[kPhaseNames[i]] = ms(ph[i]);
+  }
+  j["ms"] = p;
+  std::cout << j.dump(-1, ' ', false, json::error_handler_t::replace) << '\n';
+}
+
+}
+
+int main(int argc, char** argv) {
+  bool stats = false;
+  bool slow_only = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--stats") == 0) stats = true;
+    else if (std::strcmp(argv[i], "--slow-only") == 0) slow_only = true;
+    else if (!path && argv[i][0] != '-') path = argv[i];
+    else path = nullptr, i = argc;
+  }
+  if (!path) {
+    std::cerr << "usage: " << argv[0] << " [--stats] [--slow-only] <access_log_file>\n";
+    return 2;
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "cannot open " << path << "\n";
+    return 1;
+  }
+
+  AccessLogHeader h{};
+  bool have_header = false;
+  std::vector<int64_t> samples[kPhaseCount];
+  std::vector<std::pair<int, uint64_t>> statuses;
+  uint64_t count = 0;
+
+  char buf[sizeof(AccessRecord)];
+  while (in.read(buf, sizeof(kAccessLogMagic))) {
+    if (std::memcmp(buf, kAccessLogMagic, sizeof(kAccessLogMagic)) == 0) {
+      std::memcpy(&h, buf, sizeof(kAccessLogMagic));
+      if (!in.read(reinterpret_cast<char*>(&h) + sizeof(kAccessLogMagic), sizeof(h) - sizeof(kAccessLogMagic))) break;
+      if (h.record_size != sizeof(AccessRecord)) {
+        std::cerr << path << ": unsupported record size " << h.record_size << "\n";
+        return 1;
+      }
+      have_header = true;
+      continue;
+    }
+    if (!have_header) {
+      std::cerr << path << ": not a minihttpd access log\n";
+      return 1;
+    }
+    if (!in.read(buf + sizeof(kAccessLogMagic), sizeof(buf) - sizeof(kAccessLogMagic))) break;
+
+    AccessRecord r;
+    std::memcpy(&r, buf, sizeof(r));
+    if (slow_only && !(r.flags & kAccessSlow)) continue;
+    count++;
+
+    if (!stats) {
+      print_record(r, h);
+      continue;
+    }
+
+    int64_t ph[kPhaseCount];
+    phases(r, ph);
+    for (int i = 0; i < kPhaseCount; i++) {
+      if (ph[i] >= 0) samples[i].push_back(ph[i]);
+    }
+    auto it = std::find_if(statuses.begin(), statuses.end(), [&](const auto& s) { return s.first == r.status; });
+    if (it == statuses.end()) statuses.push_back({r.status, 1});
+    else it->second++;
+  }
+  // A short tail is a record the server was still writing; ignore it.
+  if (in.bad()) {
+    std::cerr << path << ": read error\n";
+    return 1;
+  }
+
+  if (!stats) return 0;
+
+  json out;
+  out["requests"] = count;
+  std::sort(statuses.begin(), statuses.end());
+  json st = json::object();
+  for (const auto& [code, n] : statuses) st[std::to_string(code)] = n;
+  out["status"] = st;
+
+  json ph = json::object();
+  for (int i = 0; i < kPhaseCount; i++) {
+    auto& v = samples[i];
+    if (v.empty()) continue;
+    std::sort(v.begin(), v.end());
+    ph[kPhaseNames[i]] = {
+      {"count", v.size()},
+      {"p50", ms(percentile(v, 50))},
+      {"p90", ms(percentile(v, 90))},
+      {"p99", ms(percentile(v, 99))},
+      {"p99.9", ms(percentile(v, 99.9))},
+      {"max", ms(v.back())},
+    };
+  }
+  out["ms"] = ph;
+  std::cout << out.dump(2) << '\n';
+  return 0;
+}